@@ -4,6 +4,10 @@
 #include "AI.hpp"
 #include "Engine.hpp"
 #include "Game.hpp"
+#include "ThreadPool.hpp"
+#include "Allocations.hpp"
+
+#include <cfloat>
 
 const int AI::Outputs = Genome::Output::OUT_MAX;
 
@@ -27,6 +31,9 @@ const float AI::EnableMutationChance = 0.2f;
 
 const int AI::MaxNodes = 1000000;
 
+const int AI::DefaultBatchGenomes = 4;
+const int AI::RacingWave = 60;
+
 void Gene::serialize(FileInterface* file) {
 	int version = 0;
 	file->property("version", version);
@@ -38,6 +45,7 @@ void Gene::serialize(FileInterface* file) {
 }
 
 Genome::Genome() {
+	mutationRates.reserve(7);
 	mutationRates.insert("connections", AI::MutateConnectionsChance);
 	mutationRates.insert("link", AI::LinkMutationChance);
 	mutationRates.insert("bias", AI::BiasMutationChance);
@@ -47,7 +55,11 @@ Genome::Genome() {
 	mutationRates.insert("step", AI::StepSize);
 }
 
+std::atomic<Uint64> Genome::numCopies { 0 };
+std::atomic<Uint64> Genome::numMoves { 0 };
+
 Genome::Genome(const Genome& src) {
+	++numCopies;
 	genes.copy(src.genes);
 	fitness = src.fitness;
 	network = src.network;
@@ -57,15 +69,47 @@ Genome::Genome(const Genome& src) {
 	pool = src.pool;
 	framesSurvived = src.framesSurvived;
 	currentFrame = src.currentFrame;
-	game = src.game;
-	if (game) {
-		game->genome = this;
-	}
+	runSeed = src.runSeed;
+	episode = src.episode;
+	episodeFitness = src.episodeFitness;
+	episodeTotal = src.episodeTotal;
+	abandonBelow = src.abandonBelow;
+	evaluatedChanges = src.evaluatedChanges;
+	game = src.game; // shared, but it still reports to src
 	finished = src.finished;
 	totalDanger = src.totalDanger;
+	pendingInnovations.copy(src.pendingInnovations);
+}
+
+Genome::Genome(Genome&& src) :
+	genes(std::move(src.genes)),
+	fitness(src.fitness),
+	network(std::move(src.network)),
+	maxNeuron(src.maxNeuron),
+	globalRank(src.globalRank),
+	mutationRates(std::move(src.mutationRates)),
+	pool(src.pool),
+	framesSurvived(src.framesSurvived),
+	currentFrame(src.currentFrame),
+	runSeed(src.runSeed),
+	episode(src.episode),
+	episodeFitness(src.episodeFitness),
+	episodeTotal(src.episodeTotal),
+	abandonBelow(src.abandonBelow),
+	evaluatedChanges(src.evaluatedChanges),
+	game(std::move(src.game)),
+	finished(src.finished),
+	totalDanger(src.totalDanger),
+	pendingInnovations(std::move(src.pendingInnovations))
+{
+	++numMoves;
+	if (game && game->genome == &src) {
+		game->genome = this;
+	}
 }
 
 Genome& Genome::operator=(const Genome& src) {
+	++numCopies;
 	genes.copy(src.genes);
 	fitness = src.fitness;
 	network = src.network;
@@ -75,88 +119,631 @@ Genome& Genome::operator=(const Genome& src) {
 	pool = src.pool;
 	framesSurvived = src.framesSurvived;
 	currentFrame = src.currentFrame;
-	game = src.game;
-	if (game) {
+	runSeed = src.runSeed;
+	episode = src.episode;
+	episodeFitness = src.episodeFitness;
+	episodeTotal = src.episodeTotal;
+	abandonBelow = src.abandonBelow;
+	evaluatedChanges = src.evaluatedChanges;
+	game = src.game; // shared, but it still reports to src
+	finished = src.finished;
+	totalDanger = src.totalDanger;
+	pendingInnovations.copy(src.pendingInnovations);
+	return *this;
+}
+
+Genome& Genome::operator=(Genome&& src) {
+	if (this == &src) {
+		return *this;
+	}
+	++numMoves;
+	genes = std::move(src.genes);
+	fitness = src.fitness;
+	network = std::move(src.network);
+	maxNeuron = src.maxNeuron;
+	globalRank = src.globalRank;
+	mutationRates = std::move(src.mutationRates);
+	pool = src.pool;
+	framesSurvived = src.framesSurvived;
+	currentFrame = src.currentFrame;
+	runSeed = src.runSeed;
+	episode = src.episode;
+	episodeFitness = src.episodeFitness;
+	episodeTotal = src.episodeTotal;
+	abandonBelow = src.abandonBelow;
+	evaluatedChanges = src.evaluatedChanges;
+	game = std::move(src.game);
+	if (game && game->genome == &src) {
 		game->genome = this;
 	}
 	finished = src.finished;
 	totalDanger = src.totalDanger;
+	pendingInnovations = std::move(src.pendingInnovations);
 	return *this;
 }
 
 void Genome::generateNetwork() {
-	network.neurons.clear();
+	network.compile(genes, pool->inputSize);
+}
+
+void Network::compile(const ArrayList<Gene>& genes, int _inputSize) {
+	inputSize = _inputSize;
 
-	for (int c = 0; c < pool->inputSize; ++c) {
-		network.neurons.insert(c, Neuron());
+	// collect every neuron that isn't an input, in id order
+	ArrayList<int> ids;
+	Map<int, int> slots;
+	slots.reserve(AI::Outputs + genes.getSize() * 2);
+	auto addNeuron = [&](int id) {
+		if (id >= 0 && id < inputSize) {
+			return;
+		}
+		if (!slots.exists(id)) {
+			slots.insert(id, 0);
+			ids.push(id);
+		}
+	};
+	for (int o = 0; o < AI::Outputs; ++o) {
+		addNeuron(AI::MaxNodes + o);
+	}
+	for (auto& gene : genes) {
+		if (gene.enabled) {
+			addNeuron(gene.into);
+			addNeuron(gene.out);
+		}
+	}
+	std::sort(ids.getArray(), ids.getArray() + ids.getSize());
+	int numHidden = (int)ids.getSize();
+	for (int c = 0; c < numHidden; ++c) {
+		*slots[ids[c]] = c;
 	}
 
-	for (int c = 0; c < AI::Outputs; ++c) {
-		network.neurons.insert(AI::MaxNodes + c, Neuron());
+	// count connections between non-input neurons
+	ArrayList<int> indegree;
+	ArrayList<int> outStart;
+	indegree.resize(numHidden);
+	outStart.resize(numHidden + 1);
+	for (int c = 0; c <= numHidden; ++c) {
+		outStart[c] = 0;
+	}
+	for (int c = 0; c < numHidden; ++c) {
+		indegree[c] = 0;
+	}
+	for (auto& gene : genes) {
+		if (gene.enabled && !(gene.into >= 0 && gene.into < inputSize)) {
+			++indegree[*slots[gene.out]];
+			++outStart[*slots[gene.into] + 1];
+		}
+	}
+	for (int c = 0; c < numHidden; ++c) {
+		outStart[c + 1] += outStart[c];
+	}
+	ArrayList<int> outgoing;
+	ArrayList<int> fill;
+	outgoing.resize(outStart[numHidden]);
+	fill.resize(numHidden);
+	for (int c = 0; c < numHidden; ++c) {
+		fill[c] = outStart[c];
+	}
+	for (auto& gene : genes) {
+		if (gene.enabled && !(gene.into >= 0 && gene.into < inputSize)) {
+			int from = *slots[gene.into];
+			outgoing[fill[from]++] = *slots[gene.out];
+		}
 	}
 
-	genes.sort(Gene::AscSort());
-	for (int i = 0; i < genes.getSize(); ++i) {
-		auto& gene = genes[i];
-		if (gene.enabled) {
-			if (network.neurons[gene.out] == nullptr) {
-				network.neurons.insert(gene.out, Neuron());
+	// kahn's algorithm, one wave of ready neurons at a time (in id order).
+	// if only cycles remain, the lowest id still waiting goes next and reads stale values.
+	ArrayList<int> rank;
+	ArrayList<bool> emitted;
+	rank.resize(numHidden);
+	emitted.resize(numHidden);
+	for (int c = 0; c < numHidden; ++c) {
+		emitted[c] = false;
+	}
+	ArrayList<int> wave;
+	int numEmitted = 0;
+	levels.resize(0);
+	while (numEmitted < numHidden) {
+		wave.resize(0);
+		for (int c = 0; c < numHidden; ++c) {
+			if (!emitted[c] && indegree[c] == 0) {
+				wave.push(c);
 			}
-			Neuron& neuron = *network.neurons[gene.out];
-			neuron.incoming.push(&gene);
-			if (network.neurons[gene.into] == nullptr) {
-				network.neurons.insert(gene.into, Neuron());
+		}
+		if (wave.empty()) {
+			for (int c = 0; c < numHidden; ++c) {
+				if (!emitted[c]) {
+					wave.push(c);
+					break;
+				}
 			}
 		}
+		levels.push(numEmitted);
+		for (auto c : wave) {
+			emitted[c] = true;
+			rank[c] = numEmitted++;
+		}
+		for (auto c : wave) {
+			for (int i = outStart[c]; i < outStart[c + 1]; ++i) {
+				--indegree[outgoing[i]];
+			}
+		}
+	}
+
+	// lay out incoming connections by evaluation order, keeping gene order within a neuron
+	auto denseIndex = [&](int id) {
+		if (id >= 0 && id < inputSize) {
+			return id;
+		}
+		return inputSize + rank[*slots[id]];
+	};
+	offsets.resize(numHidden + 1);
+	for (int c = 0; c <= numHidden; ++c) {
+		offsets[c] = 0;
+	}
+	for (auto& gene : genes) {
+		if (gene.enabled) {
+			++offsets[rank[*slots[gene.out]] + 1];
+		}
+	}
+	for (int c = 0; c < numHidden; ++c) {
+		offsets[c + 1] += offsets[c];
+	}
+	sources.resize(offsets[numHidden]);
+	weights.resize(offsets[numHidden]);
+	for (int c = 0; c < numHidden; ++c) {
+		fill[c] = offsets[c];
+	}
+	recurrent = false;
+	for (auto& gene : genes) {
+		if (gene.enabled) {
+			int& pos = fill[rank[*slots[gene.out]]];
+			sources[pos] = denseIndex(gene.into);
+			weights[pos] = gene.weight;
+			++pos;
+
+			// a source that isn't evaluated before its neuron is read as it was last time
+			if (sources[pos - 1] >= denseIndex(gene.out)) {
+				recurrent = true;
+			}
+		}
+	}
+
+	levels.push(numHidden);
+
+	outputs.resize(AI::Outputs);
+	for (int o = 0; o < AI::Outputs; ++o) {
+		outputs[o] = denseIndex(AI::MaxNodes + o);
+	}
+
+	values.resize(inputSize + numHidden);
+	for (size_t c = 0; c < values.getSize(); ++c) {
+		values[c] = 0.f;
+	}
+
+	// fingerprint the layout so batches can find networks that share it (FNV-1a)
+	topology = 2166136261U;
+	auto mix = [this](int value) {
+		topology = (topology ^ (Uint32)value) * 16777619U;
+	};
+	mix(inputSize);
+	mix(numHidden);
+	for (auto offset : offsets) {
+		mix(offset);
+	}
+	for (auto source : sources) {
+		mix(source);
+	}
+	for (auto output : outputs) {
+		mix(output);
 	}
 }
 
-float Genome::sigmoid(float x) {
+float Network::sigmoid(float x) {
 	return 2.f / (1.f + expf(-4.9f * x)) - 1.f;
 }
 
-ArrayList<float> Genome::evaluateNetwork(ArrayList<float>& inputs) {
-	if (inputs.getSize() != pool->inputSize) {
-		mainEngine->fmsg(Engine::MSG_WARN, "incorrect number of neural network inputs");
-		return ArrayList<float>();
+// sigmoid(x) = 2 / (1 + e^y) - 1 with y = -4.9x. e^y is split into 2^n * e^r with |r| <= ln(2)/2,
+// and e^r comes from a degree 6 polynomial (relative error around 1e-7). sigmoid(0) is exactly 0.
+static const float sigmoidScale = -4.9f;
+static const float expLimit = 87.f;
+static const float expLog2e = 1.44269504088896341f;
+static const float expLn2Hi = 0.693359375f;
+static const float expLn2Lo = -2.12194440e-4f;
+static const float expPoly[7] = {
+	1.f, 1.f, 1.f / 2.f, 1.f / 6.f, 1.f / 24.f, 1.f / 120.f, 1.f / 720.f
+};
+
+#if defined(NETWORK_AVX2)
+static inline __m256 sigmoid8(__m256 x) {
+	__m256 y = _mm256_mul_ps(x, _mm256_set1_ps(sigmoidScale));
+	y = _mm256_min_ps(_mm256_max_ps(y, _mm256_set1_ps(-expLimit)), _mm256_set1_ps(expLimit));
+	__m256i ni = _mm256_cvtps_epi32(_mm256_mul_ps(y, _mm256_set1_ps(expLog2e)));
+	__m256 n = _mm256_cvtepi32_ps(ni);
+	__m256 r = _mm256_sub_ps(y, _mm256_mul_ps(n, _mm256_set1_ps(expLn2Hi)));
+	r = _mm256_sub_ps(r, _mm256_mul_ps(n, _mm256_set1_ps(expLn2Lo)));
+	__m256 p = _mm256_set1_ps(expPoly[6]);
+	for (int c = 5; c >= 0; --c) {
+		p = _mm256_add_ps(_mm256_mul_ps(p, r), _mm256_set1_ps(expPoly[c]));
+	}
+	__m256i bits = _mm256_slli_epi32(_mm256_add_epi32(ni, _mm256_set1_epi32(127)), 23);
+	__m256 e = _mm256_mul_ps(p, _mm256_castsi256_ps(bits));
+	__m256 one = _mm256_set1_ps(1.f);
+	return _mm256_sub_ps(_mm256_div_ps(_mm256_set1_ps(2.f), _mm256_add_ps(one, e)), one);
+}
+#elif defined(NETWORK_SSE)
+static inline __m128 sigmoid4(__m128 x) {
+	__m128 y = _mm_mul_ps(x, _mm_set1_ps(sigmoidScale));
+	y = _mm_min_ps(_mm_max_ps(y, _mm_set1_ps(-expLimit)), _mm_set1_ps(expLimit));
+	__m128i ni = _mm_cvtps_epi32(_mm_mul_ps(y, _mm_set1_ps(expLog2e)));
+	__m128 n = _mm_cvtepi32_ps(ni);
+	__m128 r = _mm_sub_ps(y, _mm_mul_ps(n, _mm_set1_ps(expLn2Hi)));
+	r = _mm_sub_ps(r, _mm_mul_ps(n, _mm_set1_ps(expLn2Lo)));
+	__m128 p = _mm_set1_ps(expPoly[6]);
+	for (int c = 5; c >= 0; --c) {
+		p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(expPoly[c]));
+	}
+	__m128i bits = _mm_slli_epi32(_mm_add_epi32(ni, _mm_set1_epi32(127)), 23);
+	__m128 e = _mm_mul_ps(p, _mm_castsi128_ps(bits));
+	__m128 one = _mm_set1_ps(1.f);
+	return _mm_sub_ps(_mm_div_ps(_mm_set1_ps(2.f), _mm_add_ps(one, e)), one);
+}
+#endif
+
+float Network::sigmoidFast(float x) {
+	// a lone value goes through the same instructions as a full vector, so a neuron's value
+	// doesn't depend on where it falls in sigmoidRange()
+#if defined(NETWORK_AVX2)
+	return _mm256_cvtss_f32(sigmoid8(_mm256_set1_ps(x)));
+#elif defined(NETWORK_SSE)
+	return _mm_cvtss_f32(sigmoid4(_mm_set1_ps(x)));
+#else
+	float y = std::min(std::max(x * sigmoidScale, -expLimit), expLimit);
+	float n = floorf(y * expLog2e + .5f);
+	float r = y - n * expLn2Hi - n * expLn2Lo;
+	float p = expPoly[6];
+	for (int c = 5; c >= 0; --c) {
+		p = p * r + expPoly[c];
+	}
+	Sint32 bits = ((Sint32)n + 127) << 23;
+	float scale;
+	memcpy(&scale, &bits, sizeof(float));
+	return 2.f / (1.f + p * scale) - 1.f;
+#endif
+}
+
+// weightedSum() keeps this many partial sums, connection c going into partial c % sumWidth, and
+// adds them up pairwise at the end. NetworkBatch::evaluateGroup() sums each lane the same way.
+// (they only match bit for bit if the compiler doesn't fuse multiplies and adds, as /fp:precise doesn't)
+#if defined(NETWORK_AVX2)
+static const int sumWidth = 8;
+#elif defined(NETWORK_SSE)
+static const int sumWidth = 4;
+#else
+static const int sumWidth = 1;
+#endif
+
+// @return how many of a neuron's connections weightedSum() adds into partial sums, the rest are
+// added one at a time afterwards
+static inline int blockedConnections(int count) {
+	return sumWidth > 1 && count < sumWidth ? 0 : count - count % sumWidth;
+}
+
+// weighted sum of a neuron's incoming connections
+static inline float weightedSum(const float* v, const int* source, const float* weight, int count) {
+	int c = 0;
+	float sum = 0.f;
+#if defined(NETWORK_AVX2)
+	if (count >= 8) {
+		__m256 acc = _mm256_setzero_ps();
+		for (; c + 8 <= count; c += 8) {
+			__m256i idx = _mm256_loadu_si256((const __m256i*)(source + c));
+			__m256 src = _mm256_i32gather_ps(v, idx, 4);
+			acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_loadu_ps(weight + c), src));
+		}
+		__m128 half = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+		half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+		half = _mm_add_ss(half, _mm_shuffle_ps(half, half, 1));
+		sum = _mm_cvtss_f32(half);
+	}
+#elif defined(NETWORK_SSE)
+	if (count >= 4) {
+		__m128 acc = _mm_setzero_ps();
+		for (; c + 4 <= count; c += 4) {
+			__m128 src = _mm_set_ps(v[source[c + 3]], v[source[c + 2]], v[source[c + 1]], v[source[c]]);
+			acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(weight + c), src));
+		}
+		acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+		acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+		sum = _mm_cvtss_f32(acc);
 	}
+#endif
+	for (; c < count; ++c) {
+		sum += weight[c] * v[source[c]];
+	}
+	return sum;
+}
 
-	for (int i = 0; i < pool->inputSize; ++i) {
-		Neuron* neuron = network.neurons[i];
-		assert(neuron);
-		neuron->value = inputs[i];
+// apply the sigmoid to a run of neuron values in place
+static inline void sigmoidRange(float* v, int count) {
+	int c = 0;
+#if defined(NETWORK_AVX2)
+	for (; c + 8 <= count; c += 8) {
+		_mm256_storeu_ps(v + c, sigmoid8(_mm256_loadu_ps(v + c)));
+	}
+#elif defined(NETWORK_SSE)
+	for (; c + 4 <= count; c += 4) {
+		_mm_storeu_ps(v + c, sigmoid4(_mm_loadu_ps(v + c)));
 	}
+#endif
+	for (; c < count; ++c) {
+		v[c] = Network::sigmoidFast(v[c]);
+	}
+}
+
+void Network::run(float* v, const float* inputs, float* out, bool vectorized) const {
+	for (int i = 0; i < inputSize; ++i) {
+		v[i] = inputs[i];
+	}
+
+	const int* offset = offsets.getArray();
+	const int* source = sources.getArray();
+	const float* weight = weights.getArray();
+	float* hidden = v + inputSize;
+	if (vectorized) {
+		// neurons in a level never read each other, so sum the whole level and then squash it.
+		// a neuron without connections sums to 0, and sigmoid(0) is 0 as the scalar path expects
+		for (size_t l = 0; l + 1 < levels.getSize(); ++l) {
+			int start = levels[l];
+			int end = levels[l + 1];
+			for (int n = start; n < end; ++n) {
+				hidden[n] = weightedSum(v, source + offset[n], weight + offset[n], offset[n + 1] - offset[n]);
+			}
+			sigmoidRange(hidden + start, end - start);
+		}
+	} else {
+		int numHidden = (int)values.getSize() - inputSize;
+		for (int n = 0; n < numHidden; ++n) {
+			int start = offset[n];
+			int end = offset[n + 1];
+			if (start == end) {
+				hidden[n] = 0.f;
+				continue;
+			}
+			float sum = 0.f;
+			for (int c = start; c < end; ++c) {
+				sum += weight[c] * v[source[c]];
+			}
+			hidden[n] = sigmoid(sum);
+		}
+	}
+
+	for (int o = 0; o < AI::Outputs; ++o) {
+		out[o] = v[outputs[o]];
+	}
+}
+
+void Network::evaluate(const float* inputs, float* out) {
+	run(values.getArray(), inputs, out, true);
+}
+
+void Network::evaluateScalar(const float* inputs, float* out) {
+	run(values.getArray(), inputs, out, false);
+}
 
-	for (auto& pair : network.neurons) {
-		auto& neuron = pair.b;
-		float sum = 0;
-		for (int j = 0; j < neuron.incoming.getSize(); ++j) {
-			auto& incoming = neuron.incoming[j];
-			auto other = network.neurons[incoming->into];
-			assert(other);
-			sum += incoming->weight * other->value;
+void Network::kernelTolerance(float* tolerances) const {
+	// rounding while summing n terms is at most n * epsilon * the sum of their magnitudes, and the
+	// sigmoid's slope (2.45 at most) carries each neuron's error on to the neurons reading it.
+	// the polynomial and expf() each add a little error of their own
+	static const float slope = 2.45f;
+	static const float sigmoidError = 1e-6f;
+
+	ArrayList<float> errors;
+	errors.resize(values.getSize());
+	for (size_t c = 0; c < errors.getSize(); ++c) {
+		errors[c] = 0.f;
+	}
+	int numHidden = (int)values.getSize() - inputSize;
+	for (int n = 0; n < numHidden; ++n) {
+		float carried = 0.f;
+		float magnitude = 0.f;
+		for (int c = offsets[n]; c < offsets[n + 1]; ++c) {
+			carried += fabsf(weights[c]) * errors[sources[c]];
+			magnitude += fabsf(weights[c] * values[sources[c]]);
 		}
+		int count = offsets[n + 1] - offsets[n];
+		errors[inputSize + n] = slope * (carried + count * FLT_EPSILON * magnitude) + sigmoidError;
+	}
 
-		if (neuron.incoming.getSize()) {
-			neuron.value = sigmoid(sum);
+	// twice the estimate, as it is taken from the scalar kernel's values rather than exact ones
+	for (int o = 0; o < AI::Outputs; ++o) {
+		tolerances[o] = errors[outputs[o]] * 2.f;
+	}
+}
+
+bool Network::sameTopology(const Network& other) const {
+	if (topology != other.topology || inputSize != other.inputSize ||
+		values.getSize() != other.values.getSize() || sources.getSize() != other.sources.getSize()) {
+		return false;
+	}
+	return memcmp(offsets.getArray(), other.offsets.getArray(), offsets.getSize() * sizeof(int)) == 0 &&
+		memcmp(sources.getArray(), other.sources.getArray(), sources.getSize() * sizeof(int)) == 0 &&
+		memcmp(outputs.getArray(), other.outputs.getArray(), outputs.getSize() * sizeof(int)) == 0;
+}
+
+void NetworkBatch::evaluate(Network* const* networks, int count, const float* inputs, float* outputs) {
+	if (count <= 0) {
+		return;
+	}
+	done.resize(count);
+	for (int g = 0; g < count; ++g) {
+		done[g] = false;
+	}
+	for (int g = 0; g < count; ++g) {
+		if (done[g]) {
+			continue;
+		}
+		members.resize(0);
+		for (int h = g; h < count; ++h) {
+			if (!done[h] && (h == g || networks[h]->sameTopology(*networks[g]))) {
+				members.push(h);
+				done[h] = true;
+			}
+		}
+		// both add up and squash every neuron exactly the same way, so a network's outputs don't
+		// depend on which other networks are in the batch
+		if (members.getSize() == 1) {
+			evaluateOne(networks, count, g, inputs, outputs);
 		} else {
-			neuron.value = 0.f;
+			evaluateGroup(networks, count, inputs, outputs);
 		}
 	}
+}
 
-	ArrayList<float> outputs;
-	outputs.resize(AI::Outputs);
+void NetworkBatch::evaluateOne(Network* const* networks, int count, int index, const float* inputs, float* outputs) {
+	Network& network = *networks[index];
+	column.resize(network.inputSize);
+	for (int i = 0; i < network.inputSize; ++i) {
+		column[i] = inputs[i * count + index];
+	}
+	float result[Genome::Output::OUT_MAX];
+	network.evaluate(column.getArray(), result);
 	for (int o = 0; o < AI::Outputs; ++o) {
-		Neuron* neuron = network.neurons[AI::MaxNodes + o];
-		assert(neuron);
-		outputs[o] = neuron->value;
+		outputs[o * count + index] = result[o];
+	}
+}
+
+void NetworkBatch::evaluateGroup(Network* const* networks, int count, const float* inputs, float* outputs) {
+	const Network& plan = *networks[members[0]];
+	const int lanes = (int)members.getSize();
+	const int numNeurons = (int)plan.values.getSize();
+	const int numConnections = (int)plan.weights.getSize();
+	const int inputSize = plan.inputSize;
+
+	// interleave every member's neuron values and weights, lane k of slot n at [n * lanes + k]
+	values.resize(numNeurons * lanes);
+	weights.resize(numConnections * lanes);
+	sums.resize(lanes);
+	float* v = values.getArray();
+	float* w = weights.getArray();
+	float* sum = sums.getArray();
+	for (int k = 0; k < lanes; ++k) {
+		const Network& network = *networks[members[k]];
+		for (int i = 0; i < inputSize; ++i) {
+			v[i * lanes + k] = inputs[i * count + members[k]];
+		}
+		for (int n = inputSize; n < numNeurons; ++n) {
+			v[n * lanes + k] = network.values[n];
+		}
+		for (int c = 0; c < numConnections; ++c) {
+			w[c * lanes + k] = network.weights[c];
+		}
+	}
+
+#ifdef BUILD_DEBUG
+	// every lane has to come out exactly as its network would on its own
+	reference.resize(numNeurons * lanes);
+	for (int k = 0; k < lanes; ++k) {
+		const Network& network = *networks[members[k]];
+		for (int n = inputSize; n < numNeurons; ++n) {
+			reference[k * numNeurons + n] = network.values[n];
+		}
+	}
+#endif
+
+	// one pass over the shared plan, every lane in lockstep. each lane is summed in the order
+	// weightedSum() would sum it: partial sums first, folded pairwise, then the leftovers
+	const int* offset = plan.offsets.getArray();
+	const int* source = plan.sources.getArray();
+	partials.resize(sumWidth * lanes);
+	float* partial = partials.getArray();
+	for (int n = 0; n < numNeurons - inputSize; ++n) {
+		int begin = offset[n];
+		int end = offset[n + 1];
+		int blocked = begin + blockedConnections(end - begin);
+		for (int k = 0; k < lanes; ++k) {
+			sum[k] = 0.f;
+		}
+		if (blocked > begin) {
+			for (int c = 0; c < sumWidth * lanes; ++c) {
+				partial[c] = 0.f;
+			}
+			for (int c = begin; c < blocked; ++c) {
+				const float* src = v + source[c] * lanes;
+				const float* weight = w + c * lanes;
+				float* part = partial + ((c - begin) % sumWidth) * lanes;
+				for (int k = 0; k < lanes; ++k) {
+					part[k] += weight[k] * src[k];
+				}
+			}
+			for (int stride = sumWidth / 2; stride > 0; stride /= 2) {
+				for (int j = 0; j < stride; ++j) {
+					float* part = partial + j * lanes;
+					const float* other = partial + (j + stride) * lanes;
+					for (int k = 0; k < lanes; ++k) {
+						part[k] += other[k];
+					}
+				}
+			}
+			for (int k = 0; k < lanes; ++k) {
+				sum[k] = partial[k];
+			}
+		}
+		for (int c = blocked; c < end; ++c) {
+			const float* src = v + source[c] * lanes;
+			const float* weight = w + c * lanes;
+			for (int k = 0; k < lanes; ++k) {
+				sum[k] += weight[k] * src[k];
+			}
+		}
+		float* dest = v + (inputSize + n) * lanes;
+		for (int k = 0; k < lanes; ++k) {
+			dest[k] = sum[k];
+		}
+		sigmoidRange(dest, lanes);
 	}
 
+	for (int k = 0; k < lanes; ++k) {
+		Network& network = *networks[members[k]];
+		for (int n = inputSize; n < numNeurons; ++n) {
+			network.values[n] = v[n * lanes + k];
+		}
+		for (int o = 0; o < AI::Outputs; ++o) {
+			outputs[o * count + members[k]] = v[plan.outputs[o] * lanes + k];
+		}
+	}
+
+#ifdef BUILD_DEBUG
+	column.resize(inputSize);
+	for (int k = 0; k < lanes; ++k) {
+		for (int i = 0; i < inputSize; ++i) {
+			column[i] = inputs[i * count + members[k]];
+		}
+		float expected[Genome::Output::OUT_MAX];
+		networks[members[k]]->run(&reference[k * numNeurons], column.getArray(), expected, true);
+		for (int o = 0; o < AI::Outputs; ++o) {
+			assert(expected[o] == outputs[o * count + members[k]]);
+		}
+	}
+#endif
+}
+
+ArrayList<float> Genome::evaluateNetwork(ArrayList<float>& inputs) {
+	if (inputs.getSize() != pool->inputSize) {
+		mainEngine->fmsg(Engine::MSG_WARN, "incorrect number of neural network inputs");
+		return ArrayList<float>();
+	}
+
+	ArrayList<float> outputs;
+	outputs.resize(AI::Outputs);
+	network.evaluate(inputs.getArray(), outputs.getArray());
+
 	return outputs;
 }
 
-int Genome::randomNeuron(bool nonInput) {
+int Genome::randomNeuron(bool nonInput, Random& rand) {
 	Map<int, bool> neurons;
+	neurons.reserve((nonInput ? 0 : pool->inputSize) + AI::Outputs + genes.getSize() * 2);
 
 	if (!nonInput) {
 		for (int i = 0; i < pool->inputSize; ++i) {
@@ -188,7 +775,7 @@ int Genome::randomNeuron(bool nonInput) {
 	}
 
 	assert(neurons.getSize());
-	int n = pool->rand.getUint32() % neurons.getSize();
+	int n = rand.getBounded((Uint32)neurons.getSize());
 	for (auto& pair : neurons) {
 		if (n == 0) {
 			return pair.a;
@@ -209,22 +796,27 @@ bool Genome::containsLink(const Gene& link) {
 	return false;
 }
 
-void Genome::pointMutate() {
+void Genome::pointMutate(Random& rand) {
 	auto step = *mutationRates["step"];
 
+	// every gene takes two draws either way, so they are drawn all at once
+	thread_local ArrayList<float> draws;
+	draws.resize(genes.getSize() * 2);
+	rand.fill(draws.getArray(), draws.getSize());
+
 	for (int i = 0; i < genes.getSize(); ++i) {
 		auto& gene = genes[i];
-		if (pool->rand.getFloat() < AI::PerturbChance) {
-			gene.weight = gene.weight + pool->rand.getFloat() * step * 2.f - step;
+		if (draws[i * 2] < AI::PerturbChance) {
+			gene.weight = gene.weight + draws[i * 2 + 1] * step * 2.f - step;
 		} else {
-			gene.weight = pool->rand.getFloat() * 4.f - 2.f;
+			gene.weight = draws[i * 2 + 1] * 4.f - 2.f;
 		}
 	}
 }
 
-void Genome::linkMutate(bool forceBias) {
-	auto neuron1 = randomNeuron(false);
-	auto neuron2 = randomNeuron(true);
+void Genome::linkMutate(bool forceBias, Random& rand) {
+	auto neuron1 = randomNeuron(false, rand);
+	auto neuron2 = randomNeuron(true, rand);
 
 	Gene newLink;
 	if (neuron1 <= pool->inputSize && neuron2 <= pool->inputSize) {
@@ -249,39 +841,70 @@ void Genome::linkMutate(bool forceBias) {
 		return;
 	}
 	assert(pool);
-	newLink.innovation = pool->newInnovation();
-	newLink.weight = pool->rand.getFloat() * 4.f - 2.f;
-	genes.push(newLink);
+	newLink.innovation = newInnovation(Pool::Innovation(newLink.into, newLink.out, Pool::Innovation::MUTATE_LINK));
+	newLink.weight = rand.getFloat() * 4.f - 2.f;
+	addGene(newLink);
 }
 
-void Genome::nodeMutate() {
+void Genome::nodeMutate(Random& rand) {
 	if (genes.getSize() == 0) {
 		return;
 	}
 
-	++maxNeuron;
-
-	auto& gene = genes[pool->rand.getUint32() % genes.getSize()];
+	auto& gene = genes[rand.getBounded((Uint32)genes.getSize())];
 	if (!gene.enabled) {
 		return;
 	}
 	gene.enabled = false;
 
+	// copy both halves first, pushing can move the gene we are splitting
 	auto gene1 = gene;
-	gene1.out = maxNeuron;
+	auto gene2 = gene;
+
+	// the new node is numbered along with the innovations, so every genome that splits this
+	// link this generation gets the same node
+	gene1.innovation = newInnovation(Pool::Innovation(gene2.into, gene2.out, Pool::Innovation::MUTATE_SPLIT_IN));
+	int neuron = Pool::PendingNeuron + (gene1.innovation - Pool::PendingInnovation);
+
+	gene1.out = neuron;
 	gene1.weight = 1.f;
-	gene1.innovation = pool->newInnovation();
 	gene1.enabled = true;
-	genes.push(gene1);
+	addGene(gene1);
 
-	auto gene2 = gene;
-	gene2.into = maxNeuron;
-	gene2.innovation = pool->newInnovation();
+	gene2.innovation = newInnovation(Pool::Innovation(gene2.into, gene2.out, Pool::Innovation::MUTATE_SPLIT_OUT));
+	gene2.into = neuron;
 	gene2.enabled = true;
-	genes.push(gene2);
+	addGene(gene2);
+}
+
+int Genome::newInnovation(const Pool::Innovation& mutation) {
+	pendingInnovations.push(mutation);
+	return Pool::PendingInnovation + (int)pendingInnovations.getSize() - 1;
+}
+
+void Genome::addGene(const Gene& gene) {
+	// new innovations almost always go on the end
+	size_t pos = genes.getSize();
+	while (pos > 0 && genes[pos - 1].innovation > gene.innovation) {
+		--pos;
+	}
+	if (pos == genes.getSize()) {
+		genes.push(gene);
+	} else {
+		genes.insertAndRearrange(gene, pos);
+	}
+}
+
+bool Genome::genesSorted() const {
+	for (size_t c = 1; c < genes.getSize(); ++c) {
+		if (genes[c - 1].innovation > genes[c].innovation) {
+			return false;
+		}
+	}
+	return true;
 }
 
-void Genome::enableDisableMutate(bool enable) {
+void Genome::enableDisableMutate(bool enable, Random& rand) {
 	ArrayList<Gene*> candidates;
 	for (auto& gene : genes) {
 		if (gene.enabled != enable) {
@@ -293,28 +916,28 @@ void Genome::enableDisableMutate(bool enable) {
 		return;
 	}
 
-	auto gene = candidates[pool->rand.getUint32() % candidates.getSize()];
+	auto gene = candidates[rand.getBounded((Uint32)candidates.getSize())];
 	gene->enabled = !gene->enabled;
 }
 
-void Genome::mutate() {
+void Genome::mutate(Random& rand) {
 	for (auto& pair : mutationRates) {
-		if (pool->rand.getUint32() % 2 == 0) {
+		if (rand.getUint32() % 2 == 0) {
 			pair.b *= 0.95f;
 		} else {
 			pair.b *= 1.05263f;
 		}
 	}
 
-	if (pool->rand.getFloat() < *mutationRates["connections"]) {
-		pointMutate();
+	if (rand.getFloat() < *mutationRates["connections"]) {
+		pointMutate(rand);
 	}
 
 	{
 		float p = *mutationRates["link"];
 		while (p > 0.f) {
-			if (pool->rand.getFloat() < p) {
-				linkMutate(false);
+			if (rand.getFloat() < p) {
+				linkMutate(false, rand);
 			}
 			p -= 1.f;
 		}
@@ -323,8 +946,8 @@ void Genome::mutate() {
 	{
 		float p = *mutationRates["bias"];
 		while (p > 0.f) {
-			if (pool->rand.getFloat() < p) {
-				linkMutate(true);
+			if (rand.getFloat() < p) {
+				linkMutate(true, rand);
 			}
 			p -= 1.f;
 		}
@@ -333,8 +956,8 @@ void Genome::mutate() {
 	{
 		float p = *mutationRates["node"];
 		while (p > 0.f) {
-			if (pool->rand.getFloat() < p) {
-				nodeMutate();
+			if (rand.getFloat() < p) {
+				nodeMutate(rand);
 			}
 			p -= 1.f;
 		}
@@ -343,8 +966,8 @@ void Genome::mutate() {
 	{
 		float p = *mutationRates["enable"];
 		while (p > 0.f) {
-			if (pool->rand.getFloat() < p) {
-				enableDisableMutate(true);
+			if (rand.getFloat() < p) {
+				enableDisableMutate(true, rand);
 			}
 			p -= 1.f;
 		}
@@ -353,8 +976,8 @@ void Genome::mutate() {
 	{
 		float p = *mutationRates["disable"];
 		while (p > 0.f) {
-			if (pool->rand.getFloat() < p) {
-				enableDisableMutate(false);
+			if (rand.getFloat() < p) {
+				enableDisableMutate(false, rand);
 			}
 			p -= 1.f;
 		}
@@ -368,9 +991,14 @@ void Genome::serialize(FileInterface* file) {
 	file->property("maxNeuron", maxNeuron);
 	file->property("mutationRates", mutationRates);
 	file->property("genes", genes);
+	if (file->isReading() && !genesSorted()) {
+		genes.stableSort([](const Gene& a, const Gene& b) {
+			return a.innovation < b.innovation;
+		});
+	}
 }
 
-Genome Species::crossover(Genome* g1, Genome* g2) {
+Genome Species::crossover(Genome* g1, Genome* g2, Random& rand) {
 	assert(g1);
 	assert(g2);
 
@@ -384,17 +1012,18 @@ Genome Species::crossover(Genome* g1, Genome* g2) {
 	Genome child;
 	child.pool = pool;
 
-	Map<int, Gene*> innovations2;
-	for (int i = 0; i < g2->genes.getSize(); ++i) {
-		auto& gene = g2->genes[i];
-		innovations2.insert(gene.innovation, &gene);
-	}
-
+	// both gene lists are sorted by innovation, so matching genes are found by walking them together
+	assert(g1->genesSorted() && g2->genesSorted());
+	child.genes.alloc(g1->genes.getSize());
+	size_t j = 0;
 	for (int i = 0; i < g1->genes.getSize(); ++i) {
 		auto& gene1 = g1->genes[i];
-		auto gene2 = innovations2[gene1.innovation];
-		if (gene2 != nullptr && pool->rand.getUint8()%2 == 0 && (*gene2)->enabled) {
-			child.genes.push(**gene2);
+		while (j < g2->genes.getSize() && g2->genes[j].innovation < gene1.innovation) {
+			++j;
+		}
+		const Gene* gene2 = j < g2->genes.getSize() && g2->genes[j].innovation == gene1.innovation ? &g2->genes[j] : nullptr;
+		if (gene2 != nullptr && rand.getUint8()%2 == 0 && gene2->enabled) {
+			child.genes.push(*gene2);
 		} else {
 			child.genes.push(gene1);
 		}
@@ -411,75 +1040,77 @@ Genome Species::crossover(Genome* g1, Genome* g2) {
 	return child;
 }
 
-float Species::disjoint(Genome* g1, Genome* g2) {
+Species::Distance Species::distance(const Genome* g1, const Genome* g2) const {
 	assert(g1);
 	assert(g2);
-
-	Map<int, bool> i1;
-	for (int i = 0; i < g1->genes.getSize(); ++i) {
-		auto& gene = g1->genes[i];
-		i1.insert(gene.innovation, true);
-	}
-
-	Map<int, bool> i2;
-	for (int i = 0; i < g2->genes.getSize(); ++i) {
-		auto& gene = g2->genes[i];
-		i2.insert(gene.innovation, true);
-	}
-
-	int result = 0;
-
-	for (int i = 0; i < g1->genes.getSize(); ++i) {
-		auto& gene = g1->genes[i];
-		if (!i2[gene.innovation]) {
-			++result;
+	assert(g1->genesSorted() && g2->genesSorted());
+
+	Distance result;
+	const Gene* genes1 = g1->genes.getArray();
+	const Gene* genes2 = g2->genes.getArray();
+	size_t n1 = g1->genes.getSize();
+	size_t n2 = g2->genes.getSize();
+	size_t i = 0, j = 0;
+	float sum = 0;
+	while (i < n1 && j < n2) {
+		if (genes1[i].innovation < genes2[j].innovation) {
+			++result.disjoint;
+			++i;
+		} else if (genes2[j].innovation < genes1[i].innovation) {
+			++result.disjoint;
+			++j;
+		} else {
+			sum += fabs(genes1[i].weight - genes2[j].weight);
+			++result.matching;
+			++i;
+			++j;
 		}
 	}
+	result.excess = (int)((n1 - i) + (n2 - j));
 
-	for (int i = 0; i < g2->genes.getSize(); ++i) {
-		auto& gene = g2->genes[i];
-		if (!i1[gene.innovation]) {
-			++result;
-		}
-	}
+	// same arithmetic as always, including 0 / 0 when there is nothing to compare
+	int n = (int)std::max(n1, n2);
+	result.disjointDelta = (float)(result.excess + result.disjoint) / n;
+	result.weightDelta = sum / result.matching;
+	return result;
+}
 
-	int n = (int)std::max(g1->genes.getSize(), g2->genes.getSize());
-	return (float)result / n;
+float Species::disjoint(Genome* g1, Genome* g2) {
+	return distance(g1, g2).disjointDelta;
 }
 
 float Species::weights(Genome* g1, Genome* g2) {
-	assert(g1);
-	assert(g2);
-
-	Map<int, Gene*> i2;
-	for (int i = 0; i < g2->genes.getSize(); ++i) {
-		auto& gene = g2->genes[i];
-		i2.insert(gene.innovation, &gene);
-	}
-
-	float sum = 0;
-	int coincident = 0;
-	for (int i = 0; i < g1->genes.getSize(); ++i) {
-		auto& gene = g1->genes[i];
-		if (i2[gene.innovation] != nullptr) {
-			auto& gene2 = **i2[gene.innovation];
-			sum += fabs(gene.weight - gene2.weight);
-			++coincident;
-		}
-	}
-
-	return sum / coincident;
+	return distance(g1, g2).weightDelta;
 }
 
 bool Species::sameSpecies(Genome* g1, Genome* g2) {
 	assert(g1);
 	assert(g2);
 
-	float dd = AI::DeltaDisjoint * disjoint(g1, g2);
-	float dw = AI::DeltaWeights * weights(g1, g2);
+	Distance d = distance(g1, g2);
+	float dd = AI::DeltaDisjoint * d.disjointDelta;
+	float dw = AI::DeltaWeights * d.weightDelta;
 	return (dd + dw) < AI::DeltaThreshold;
 }
 
+int64_t Species::cullThreshold() const {
+	// same count as Pool::cullSpecies() keeps
+	size_t keep = (size_t)ceilf(genomes.getSize() / 2.f);
+	ArrayList<int64_t> done;
+	for (auto& genome : genomes) {
+		if (genome.finished) {
+			done.push(genome.fitness);
+		}
+	}
+	if (!keep || done.getSize() < keep) {
+		return INT64_MIN;
+	}
+	done.sort([](const int64_t& a, const int64_t& b) {
+		return a > b;
+	});
+	return done[keep - 1];
+}
+
 void Species::calculateAverageFitness() {
 	int64_t total = 0;
 
@@ -494,25 +1125,29 @@ void Species::calculateAverageFitness() {
 	}
 }
 
-Genome Species::breedChild() {
-	Genome child;
-	child.pool = pool;
-	if (genomes.getSize()) {
-		if (pool->rand.getFloat() < AI::CrossoverChance) {
-			auto& g1 = genomes[pool->rand.getUint32() % genomes.getSize()];
-			auto& g2 = genomes[pool->rand.getUint32() % genomes.getSize()];
-			child = crossover(&g1, &g2);
-		} else {
-			auto& g = genomes[pool->rand.getUint32() % genomes.getSize()];
-			child = g;
-		}
-	} else {
+Genome Species::breedChild(Random& rand) {
+	if (!genomes.getSize()) {
 		assert(0); // what the heck!
+		Genome child;
+		child.pool = pool;
+		child.mutate(rand);
+		return child;
+	}
+
+	// build the child in place, the copy or crossover result is never copied again
+	if (rand.getFloat() < AI::CrossoverChance) {
+		auto& g1 = genomes[rand.getBounded((Uint32)genomes.getSize())];
+		auto& g2 = genomes[rand.getBounded((Uint32)genomes.getSize())];
+		Genome child = crossover(&g1, &g2, rand);
+		child.mutate(rand);
+		return child;
+	} else {
+		auto& g = genomes[rand.getBounded((Uint32)genomes.getSize())];
+		Genome child = g;
+		child.resetRun();
+		child.mutate(rand);
+		return child;
 	}
-
-	child.mutate();
-
-	return child;
 }
 
 void Species::serialize(FileInterface* file) {
@@ -532,8 +1167,9 @@ void Pool::init() {
 		Genome genome;
 		genome.pool = this;
 		genome.maxNeuron = inputSize;
-		genome.mutate();
-		addToSpecies(genome);
+		genome.mutate(rand);
+		resolveInnovations(genome);
+		addToSpecies(std::move(genome));
 	}
 }
 
@@ -542,6 +1178,93 @@ int Pool::newInnovation() {
 	return innovation;
 }
 
+Pool::Registered Pool::registerInnovation(const Innovation& mutation) {
+	std::lock_guard<std::mutex> lk(innovationLock);
+	Registered* found = innovations.find(mutation);
+	if (found) {
+		return *found;
+	}
+	Registered result;
+	result.innovation = newInnovation();
+	if (mutation.mutation == Innovation::MUTATE_SPLIT_IN) {
+		result.neuron = newNeuron();
+	}
+	innovations.insert(mutation, result);
+	return result;
+}
+
+int Pool::newNeuron() {
+	neuron = std::max(neuron, inputSize);
+	++neuron;
+	assert(neuron < AI::MaxNodes);
+	return neuron;
+}
+
+void Pool::resolveInnovations(Genome& genome) {
+	if (!genome.pendingInnovations.getSize()) {
+		return;
+	}
+
+	// placeholders are all at the end, in the order they were handed out
+	size_t first = genome.genes.getSize();
+	while (first > 0 && genome.genes[first - 1].innovation >= PendingInnovation) {
+		--first;
+	}
+	// the real ids of the nodes this genome's splits added, by placeholder
+	thread_local ArrayList<int> neurons;
+	neurons.resize(genome.pendingInnovations.getSize());
+	auto resolveNeuron = [&](int id) {
+		return id >= PendingNeuron ? neurons[id - PendingNeuron] : id;
+	};
+
+	bool sorted = true;
+	bool fresh = false;
+	for (size_t c = first; c < genome.genes.getSize(); ++c) {
+		auto& gene = genome.genes[c];
+		int pending = gene.innovation - PendingInnovation;
+
+		// a mutation can involve a node split earlier in the same breeding, which is resolved by now
+		auto mutation = genome.pendingInnovations[pending];
+		mutation.into = resolveNeuron(mutation.into);
+		mutation.out = resolveNeuron(mutation.out);
+		Registered registered = registerInnovation(mutation);
+
+		// the same mutation made twice in one genome (a link re-enabled and split again) gets
+		// numbers of its own, a genome never has two genes with one innovation or two splits
+		// adding one node. both halves of a split go the same way
+		if (mutation.mutation != Innovation::MUTATE_SPLIT_OUT) {
+			fresh = false;
+			for (size_t g = 0; g < c; ++g) {
+				auto& other = genome.genes[g];
+				if (other.innovation == registered.innovation ||
+					(mutation.mutation == Innovation::MUTATE_SPLIT_IN &&
+					(other.into == registered.neuron || other.out == registered.neuron))) {
+					fresh = true;
+					break;
+				}
+			}
+		}
+		if (mutation.mutation == Innovation::MUTATE_SPLIT_IN) {
+			neurons[pending] = fresh ? newNeuron() : registered.neuron;
+			genome.maxNeuron = std::max(genome.maxNeuron, neurons[pending]);
+		}
+		int result = fresh ? newInnovation() : registered.innovation;
+
+		gene.into = resolveNeuron(gene.into);
+		gene.out = resolveNeuron(gene.out);
+		gene.innovation = result;
+		sorted = sorted && (c == 0 || genome.genes[c - 1].innovation < result);
+	}
+	genome.pendingInnovations.clear();
+
+	// mutations seen earlier this generation have older numbers than the genome's newest genes
+	if (!sorted) {
+		genome.genes.stableSort([](const Gene& a, const Gene& b) {
+			return a.innovation < b.innovation;
+		});
+	}
+}
+
 void Pool::rankGlobally() {
 	ArrayList<Genome*> global;
 	for (int s = 0; s < species.getSize(); ++s) {
@@ -550,7 +1273,7 @@ void Pool::rankGlobally() {
 			global.push(&spec.genomes[g]);
 		}
 	}
-	global.sort(Genome::AscSortPtr());
+	global.stableSort(Genome::AscSortPtr());
 
 	for (int g = 0; g < global.getSize(); ++g) {
 		global[g]->globalRank = g;
@@ -570,7 +1293,7 @@ void Pool::cullSpecies(bool cutToOne) {
 	for (int s = 0; s < species.getSize(); ++s) {
 		auto& spec = species[s];
 
-		spec.genomes.sort(Genome::DescSort());
+		spec.genomes.stableSort(Genome::DescSort());
 
 		int remaining = (int)ceilf(spec.genomes.getSize() / 2.f);
 		if (cutToOne) {
@@ -589,7 +1312,7 @@ void Pool::removeStaleSpecies() {
 
 		assert(spec.genomes.getSize());
 		
-		spec.genomes.sort(Genome::DescSort());
+		spec.genomes.stableSort(Genome::DescSort());
 
 		if (spec.genomes[0].fitness > spec.topFitness) {
 			spec.topFitness = spec.genomes[0].fitness;
@@ -598,7 +1321,7 @@ void Pool::removeStaleSpecies() {
 			++spec.staleness;
 		}
 		if (spec.staleness < AI::StaleSpecies || spec.topFitness >= maxFitness) {
-			survived.push(spec);
+			survived.push(std::move(spec));
 		}
 	}
 	species.swap(survived);
@@ -611,18 +1334,18 @@ void Pool::removeWeakSpecies() {
 		auto& spec = species[s];
 		int64_t breed = sum ? (int64_t)floorf(((float)spec.averageFitness / (float)sum) * (float)AI::Population) : 1;
 		if (breed >= 1) {
-			survived.push(spec);
+			survived.push(std::move(spec));
 		}
 	}
 	species.swap(survived);
 }
 
-void Pool::addToSpecies(Genome& child) {
+void Pool::addToSpecies(Genome&& child, int firstSpecies) {
 	bool foundSpecies = false;
-	for (int s = 0; s < species.getSize(); ++s) {
+	for (int s = firstSpecies; s < species.getSize(); ++s) {
 		auto& spec = species[s];
 		if (spec.sameSpecies(&child, &spec.genomes[0])) {
-			spec.genomes.push(child);
+			spec.genomes.push(std::move(child));
 			foundSpecies = true;
 			break;
 		}
@@ -630,12 +1353,64 @@ void Pool::addToSpecies(Genome& child) {
 	if (!foundSpecies) {
 		Species childSpecies;
 		childSpecies.pool = this;
-		childSpecies.genomes.push(child);
-		species.push(childSpecies);
+		childSpecies.genomes.push(std::move(child));
+		species.push(std::move(childSpecies));
 	}
 }
 
+void Pool::breedChildren(const ArrayList<int>& parents, ArrayList<Genome>& children) {
+	size_t first = children.getSize();
+	size_t count = parents.getSize();
+
+	ArrayList<Uint64> seeds;
+	seeds.resize(count);
+	for (size_t c = 0; c < count; ++c) {
+		seeds[c] = rand.getUint64();
+	}
+
+	// each child has its own slot, so the order doesn't depend on which thread finishes first
+	children.resize(first + count);
+	forEach(count, [&](size_t c) {
+		Random stream(Random::ALG_XOSHIRO);
+		stream.seedValue64(seeds[c]);
+		children[first + c] = species[parents[c]].breedChild(stream);
+	});
+
+	// numbering the new genes child by child hands out the same innovations breeding them one
+	// after another would have
+	for (size_t c = first; c < children.getSize(); ++c) {
+		resolveInnovations(children[c]);
+	}
+}
+
+void Pool::forEach(size_t count, const std::function<void(size_t)>& fn) {
+	ThreadPool* workers = ai ? ai->getWorkers() : nullptr;
+	if (!workers || count < 2) {
+		for (size_t c = 0; c < count; ++c) {
+			fn(c);
+		}
+		return;
+	}
+
+	// a few jobs per thread, so a slow child doesn't hold everybody up
+	size_t chunk = std::max((size_t)1, count / (size_t)(workers->getNumThreads() * 4));
+	for (size_t start = 0; start < count; start += chunk) {
+		size_t end = std::min(count, start + chunk);
+		workers->push([&fn, start, end]() {
+			for (size_t c = start; c < end; ++c) {
+				fn(c);
+			}
+		});
+	}
+	workers->wait();
+}
+
 void Pool::newGeneration() {
+	auto stepStart = std::chrono::steady_clock::now();
+
+	// the same mutation only gets the same number within one generation
+	innovations.clear();
+
 	cullSpecies(false); // cull the bottom half of each species
 	rankGlobally();
 	removeStaleSpecies();
@@ -646,24 +1421,60 @@ void Pool::newGeneration() {
 	}
 	removeWeakSpecies();
 	int64_t sum = totalAverageFitness();
+
+	auto breedStart = std::chrono::steady_clock::now();
 	ArrayList<Genome> children;
+	ArrayList<int> parents;
 	for (int s = 0; s < species.getSize(); ++s) {
 		auto& spec = species[s];
 		int64_t breed = (int64_t)floorf(((float)spec.averageFitness / (float)sum) * (float)AI::Population);
 		for (int i = 0; i < breed; ++i) {
-			children.push(spec.breedChild());
+			parents.push(s);
 		}
 	}
+	breedChildren(parents, children);
 	cullSpecies(true); // cull all but the top member of each species
-	while (children.getSize() + species.getSize() < AI::Population) {
-		auto& spec = species[rand.getUint32() % species.getSize()];
-		children.push(spec.breedChild());
+	parents.resize(0);
+	while (children.getSize() + parents.getSize() + species.getSize() < AI::Population) {
+		parents.push(rand.getBounded((Uint32)species.getSize()));
 	}
+	breedChildren(parents, children);
+
+	// the survivors were scored on the last generation's pieces, they play this generation's too
+	for (auto& spec : species) {
+		for (auto& genome : spec.genomes) {
+			genome.resetRun();
+		}
+	}
+
+	// compare every child against the surviving species at once, only the children that start
+	// a new species need to look at the ones founded before them
+	auto speciateStart = std::chrono::steady_clock::now();
+	int survivors = (int)species.getSize();
+	ArrayList<int> homes;
+	homes.resize(children.getSize());
+	forEach(children.getSize(), [&](size_t c) {
+		homes[c] = -1;
+		for (int s = 0; s < survivors; ++s) {
+			if (species[s].sameSpecies(&children[c], &species[s].genomes[0])) {
+				homes[c] = s;
+				break;
+			}
+		}
+	});
 	for (int c = 0; c < children.getSize(); ++c) {
-		auto& child = children[c];
-		addToSpecies(child);
+		if (homes[c] >= 0) {
+			species[homes[c]].genomes.push(std::move(children[c]));
+		} else {
+			addToSpecies(std::move(children[c]), survivors);
+		}
 	}
 
+	auto stepEnd = std::chrono::steady_clock::now();
+	lastBreedSeconds = std::chrono::duration<double>(speciateStart - breedStart).count();
+	lastSpeciateSeconds = std::chrono::duration<double>(stepEnd - speciateStart).count();
+	lastStepSeconds = std::chrono::duration<double>(stepEnd - stepStart).count();
+
 	++generation;
 
 	StringBuf<32> buf("backup%d.json",generation);
@@ -682,6 +1493,8 @@ void Pool::savePool() {
 void Pool::loadFile(const char* filename) {
 	generation = 0;
 	innovation = AI::Outputs;
+	neuron = 0;
+	innovations.clear();
 	maxFitness = 0;
 	species.clear();
 	FileHelper::readObject(filename, *this);
@@ -705,12 +1518,19 @@ void Pool::serialize(FileInterface* file) {
 			spec.pool = this;
 			for (auto& genome : spec.genomes) {
 				genome.pool = this;
+
+				// new genes and nodes are numbered after every one we loaded
+				for (auto& gene : genome.genes) {
+					innovation = std::max(innovation, gene.innovation);
+				}
+				neuron = std::max(neuron, genome.maxNeuron);
 			}
 		}
 	}
 }
 
 AI::AI() {
+	workers = new ThreadPool();
 }
 
 AI::~AI() {
@@ -718,6 +1538,10 @@ AI::~AI() {
 		delete pool;
 		pool = nullptr;
 	}
+	if (workers) {
+		delete workers;
+		workers = nullptr;
+	}
 }
 
 void AI::init() {
@@ -727,9 +1551,19 @@ void AI::init() {
 	}
 	pool = new Pool();
 	pool->ai = this;
-	pool->rand.seedTime();
+	framesSimulated = 0;
+	generationFrames = 0;
+	generationStart = std::chrono::steady_clock::now();
+	if (!seed) {
+		Random clock;
+		seed = clock.getUint64();
+	}
+	mainEngine->fmsg(Engine::MSG_INFO, "AI seed %llu", (unsigned long long)seed);
+	pool->seed = seed;
+	pool->rand.seedValue64(Random::deriveSeed(pool->getGenerationSeed(), Pool::InitStream));
 	pool->inputSize = Game::boardW * Game::boardH;
 	pool->init();
+	generatePieces();
 	pool->writeFile("temp.json");
 }
 
@@ -739,39 +1573,35 @@ static const float aiClipFar = 500.f;
 ArrayList<float> Genome::getInputs() {
 	ArrayList<float> inputs;
 	inputs.resize(pool->inputSize);
+	fillInputs(inputs.getArray(), 1);
+	return inputs;
+}
+
+void Genome::fillInputs(float* inputs, size_t stride) {
 	assert(game.get());
 
-	if (game->gameInSession) {
-		int c = 0;
-		for (int y = 0; y < Game::boardH; ++y) {
-			for (int x = 0; x < Game::boardW; ++x, ++c) {
-				inputs[c] = game->board[c] == 0 ? 0.f : 1.f;
-			}
+	if (!game->gameInSession) {
+		for (int c = 0; c < pool->inputSize; ++c) {
+			inputs[c * stride] = 0.f;
 		}
+		return;
+	}
 
-		auto playerX = game->playerX;
-		auto playerY = game->playerY;
-		auto tetromino = game->tetromino;
-
-		int startX = playerX;
-		int startY = playerY;
-		int endX = playerX + 4;
-		int endY = playerY + 4;
-		for (int y = startY; y < endY; ++y) {
-			for (int x = startX; x < endX; ++x) {
-				if (x < 0 || y < 0 || x >= game->boardW || y >= game->boardH) {
-					continue;
-				}
-				int u = x - startX;
-				int v = y - startY;
-				if (tetrominos[tetromino][v][u]) {
-					inputs[y * game->boardW + x] = -1.f;
-				}
-			}
+	int c = 0;
+	for (int y = 0; y < Game::boardH; ++y) {
+		for (int x = 0; x < Game::boardW; ++x, ++c) {
+			inputs[c * stride] = game->board[c] == 0 ? 0.f : 1.f;
 		}
 	}
 
-	return inputs;
+	const TetrominoShape& shape = tetrominoShapes[game->tetromino];
+	for (int c = 0; c < 4; ++c) {
+		int x = game->playerX + shape.cellX[c];
+		int y = game->playerY + shape.cellY[c];
+		if (x >= 0 && y >= 0 && x < game->boardW && y < game->boardH) {
+			inputs[(y * game->boardW + x) * stride] = -1.f;
+		}
+	}
 }
 
 void Genome::clearJoypad() {
@@ -780,57 +1610,231 @@ void Genome::clearJoypad() {
 	}
 }
 
-void Genome::initializeRun() {
+void Genome::initializeRun(Uint64 seed) {
 	game = std::make_shared<Game>(pool->ai);
 	game->genome = this;
-	game->init();
+	game->init(seed, pool->ai ? pool->ai->getPieceSequence(0) : nullptr);
 	framesSurvived = 0;
 	currentFrame = 0;
+	runSeed = seed;
+	episode = 0;
+	episodeFitness = 0;
+	episodeTotal = 0;
 	finished = false;
+
+	// a copy comes with its parent's count, which a fresh game can happen to match. the network
+	// has to see the new game before its outputs count for anything
+	evaluatedChanges = game->changes - 1;
 	clearJoypad();
 	generateNetwork();
 }
 
-void Genome::evaluateCurrent() {
+void Genome::resetRun() {
+	game = nullptr;
+	fitness = 0;
+	framesSurvived = 0;
+	currentFrame = 0;
+	episode = 0;
+	episodeFitness = 0;
+	episodeTotal = 0;
+	abandonBelow = INT64_MIN;
+	finished = false;
+	totalDanger = 0.f;
+}
+
+Uint32 Genome::evaluateCurrent() {
 	if (finished) {
 		clearJoypad();
-		return;
+		return 0;
+	}
+
+	Uint32 skipped = skipQuiet();
+	if (finished) {
+		return skipped;
 	}
-	auto inputs = getInputs();
-	auto controller = evaluateNetwork(inputs);
 
-	if (controller.getSize()) {
-		if (controller[Genome::Output::OUT_LEFT] && controller[Genome::Output::OUT_RIGHT]) {
-			controller[Genome::Output::OUT_LEFT] = false;
-			controller[Genome::Output::OUT_RIGHT] = false;
+#ifdef BUILD_DEBUG
+	// once the first frame has sized the scratch buffers, a frame must not touch the heap
+	bool warm = currentFrame > 0;
+	Allocations::Scope allocations;
+#endif
+
+	// inputs are rebuilt from scratch every frame, so one buffer per thread serves every genome
+	thread_local ArrayList<float> inputs;
+	inputs.resize(pool->inputSize);
+	if (pool->ai && pool->ai->getControl() == AI::CONTROL_PLACEMENT) {
+		placePiece(inputs.getArray());
+		clearJoypad();
+	} else if (!outputsCurrent()) {
+		fillInputs(inputs.getArray(), 1);
+
+		float controller[Genome::Output::OUT_MAX];
+		network.evaluate(inputs.getArray(), controller);
+		applyController(controller);
+	}
+
+	stepGame();
+
+#ifdef BUILD_DEBUG
+	assert(!warm || finished || allocations.getCount() == 0);
+#endif
+	return skipped + 1;
+}
+
+bool Genome::outputsCurrent() const {
+	return pool->ai && pool->ai->getTimeSkip() && !network.recurrent && game->changes == evaluatedChanges;
+}
+
+Uint32 Genome::skipQuiet() {
+	if (finished || !pool->ai || !pool->ai->getTimeSkip()) {
+		return 0;
+	}
+	if (pool->ai->getControl() == AI::CONTROL_PLACEMENT) {
+		// a piece in play is placed on the next frame
+		if (game->state == Game::State::PLAY) {
+			return 0;
 		}
-		for (int c = 0; c < (int)Genome::Output::OUT_MAX; ++c) {
-			outputs[c] = controller[c];
+	} else if (!outputsCurrent()) {
+		return 0;
+	}
+
+	// stop early if the episode ends, the next one starts with a new game
+	Uint32 quiet = game->quietTicks();
+	Uint32 frames = 0;
+	int startEpisode = episode;
+	while (frames < quiet && !finished && episode == startEpisode) {
+		game->idle();
+		++currentFrame;
+		++frames;
+		recordFrame();
+	}
+	return frames;
+}
+
+void Genome::placePiece(float* inputs) {
+	if (!game->gameInSession || game->state != Game::State::PLAY) {
+		return;
+	}
+
+	Game::Placement placements[Game::maxPlacements];
+	int count = game->findPlacements(placements, Game::maxPlacements);
+	if (!count) {
+		return; // topped out, let the piece fall where it will
+	}
+
+	// the network sees each resulting board the way it sees the board in play, and its first
+	// output is taken as how much it likes it. ties go to the first placement found
+	int best = 0;
+	float bestScore = 0.f;
+	for (int p = 0; p < count; ++p) {
+		Uint16 rows[Game::boardH];
+		game->placedRows(placements[p], rows);
+		int c = 0;
+		for (int y = 0; y < Game::boardH; ++y) {
+			for (int x = 0; x < Game::boardW; ++x, ++c) {
+				inputs[c] = (rows[y] >> (x + Game::wallBits)) & 1 ? 1.f : 0.f;
+			}
 		}
-	} else {
-		for (int c = 0; c < (int)Genome::Output::OUT_MAX; ++c) {
-			outputs[c] = 0.f;
+
+		float controller[Genome::Output::OUT_MAX];
+		network.evaluate(inputs, controller);
+		if (p == 0 || controller[Genome::Output::OUT_DOWN] > bestScore) {
+			best = p;
+			bestScore = controller[Genome::Output::OUT_DOWN];
 		}
 	}
+	game->place(placements[best]);
+}
 
+void Genome::applyController(const float* controller) {
+	evaluatedChanges = game->changes;
+	for (int c = 0; c < (int)Genome::Output::OUT_MAX; ++c) {
+		outputs[c] = controller[c];
+	}
+	if (outputs[Genome::Output::OUT_LEFT] && outputs[Genome::Output::OUT_RIGHT]) {
+		outputs[Genome::Output::OUT_LEFT] = false;
+		outputs[Genome::Output::OUT_RIGHT] = false;
+	}
+}
+
+void Genome::stepGame() {
 	game->process();
+	++currentFrame;
+	recordFrame();
+}
 
+void Genome::recordFrame() {
 	if (game->gameInSession) {
 		framesSurvived = std::max(framesSurvived, (int)game->ticks);
-		fitness = game->score + framesSurvived + 1;
-		//fitness = std::max(1.f, (float)framesSurvived);
-		if (fitness == 0) {
-			fitness = -1;
+		episodeFitness = game->score + framesSurvived + 1;
+		//episodeFitness = std::max(1.f, (float)framesSurvived);
+		if (episodeFitness == 0) {
+			episodeFitness = -1;
 		}
-	} else {
-		if (fitness > pool->maxFitness) {
-			pool->maxFitness = fitness;
+		fitness = (episodeTotal + episodeFitness) / (episode + 1);
+
+		// out of frames, or good enough that we don't need to keep watching
+		Uint32 budget = pool->ai ? pool->ai->getFrameBudget() : 0;
+		int64_t cutoff = pool->ai ? pool->ai->getCutoffFitness() : 0;
+		if ((budget && currentFrame >= budget) || (cutoff && episodeFitness >= cutoff)) {
+			finishEpisode();
+		} else if (abandonBelow != INT64_MIN && fitnessBound() < abandonBelow) {
+			// culled whatever happens now, the frames are better spent on somebody else
+			finishRun();
 		}
+	} else {
+		finishEpisode();
+	}
+}
 
-		finished = true;
-		game->term();
+void Genome::finishEpisode() {
+	episodeTotal += episodeFitness;
+	++episode;
+	int episodes = pool->ai ? pool->ai->getEpisodes() : 1;
+	if (episode >= episodes) {
+		fitness = episodeTotal / episodes;
+		finishRun();
+		return;
 	}
-	++currentFrame;
+
+	// the next game reuses this one, so a genome still doesn't touch the heap between frames
+	game->init(Random::deriveSeed(runSeed, (Uint64)episode), pool->ai->getPieceSequence(episode));
+	framesSurvived = 0;
+	currentFrame = 0;
+	episodeFitness = 0;
+}
+
+int64_t Genome::fitnessBound() const {
+	Uint32 budget = pool->ai ? pool->ai->getFrameBudget() : 0;
+	if (!budget) {
+		return INT64_MAX;
+	}
+	int episodes = pool->ai->getEpisodes();
+
+	// a piece locks at most once every ticksPerSecond / 3 frames, and clears at most four lines
+	// when it does. the frames survived can't grow faster than the frames played
+	int64_t lockFrames = std::max(1, game->ticksPerSecond / 3);
+	int64_t framesLeft = budget > currentFrame ? budget - currentFrame : 0;
+	int64_t current = game->score + 4 * (framesLeft / lockFrames + 2) + framesSurvived + framesLeft + 1;
+	int64_t full = 4 * (budget / lockFrames + 2) + budget + 1;
+	int64_t total = episodeTotal + current + (episodes - episode - 1) * full;
+	return (total + episodes - 1) / episodes;
+}
+
+Uint32 Genome::evaluateToEnd() {
+	Uint32 frames = 0;
+	while (!finished) {
+		frames += evaluateCurrent();
+	}
+	return frames;
+}
+
+void Genome::finishRun() {
+	int64_t best = pool->maxFitness.load();
+	while (fitness > best && !pool->maxFitness.compare_exchange_weak(best, fitness));
+
+	finished = true;
+	game->term();
 }
 
 void AI::playTop() {
@@ -865,9 +1869,6 @@ int AI::getMeasured() const {
 }
 
 bool AI::process() {
-	int threads = 0;
-	bool result = true;
-
 	if (mainEngine->pressKey(SDL_SCANCODE_F1)) {
 		save();
 	}
@@ -875,31 +1876,44 @@ bool AI::process() {
 		load();
 	}
 
-	std::vector<std::future<void>> tasks;
+	switch (evaluation) {
+	case EVAL_COMPLETE: return processComplete();
+	default: return processLockstep();
+	}
+}
+
+// per-thread scratch for stepping chunks of genomes in lockstep
+struct LockstepScratch {
+	NetworkBatch batch;
+	ArrayList<Genome*> running;
+	ArrayList<Genome*> evaluating;
+	ArrayList<Network*> networks;
+	ArrayList<float> inputs;
+	ArrayList<float> outputs;
+};
+
+bool AI::processLockstep() {
+	bool result = true;
+
+	ArrayList<Genome*> active;
 
 	int64_t maxFitness = 0;
 
+	Uint64 generationSeed = pool->getGenerationSeed();
+	Uint64 index = 0;
 	for (auto& spec : pool->species) {
 		for (auto& gen : spec.genomes) {
 			if (gen.game == nullptr) {
-				gen.initializeRun();
+				gen.initializeRun(Random::deriveSeed(generationSeed, index));
 			}
-			if (threads < 150) {
-				if (gen.finished) {
-					if (gen.game == focus) {
-						focus = nullptr;
-					}
-				} else {
-					result = false;
-					tasks.push_back(std::async(std::launch::async, &Genome::evaluateCurrent, &gen));
-					++threads;
+			++index;
+			if (gen.finished) {
+				if (gen.game == focus) {
+					focus = nullptr;
 				}
 			} else {
-				if (!gen.finished) {
-					result = false;
-				}
-			}
-			if (!gen.finished) {
+				result = false;
+				active.push(&gen);
 				if (!focus || !focus->gameInSession || (gen.game && gen.fitness > maxFitness)) {
 					maxFitness = gen.fitness;
 					focus = gen.game;
@@ -908,22 +1922,166 @@ bool AI::process() {
 		}
 	}
 
-	for (auto& task : tasks) {
-		task.wait();
+	// between batches is the one time nobody is running, so the cull thresholds move here
+	updateRacing();
+
+	// each job steps a chunk of genomes through a batch of frames before we synchronize
+	for (size_t c = 0; c < active.getSize(); c += batchGenomes) {
+		Genome** chunk = &active[c];
+		size_t count = std::min((size_t)batchGenomes, active.getSize() - c);
+		int frames = batchFrames;
+		int inputSize = pool->inputSize;
+		workers->push([this, chunk, count, frames, inputSize]() {
+			thread_local LockstepScratch scratch;
+			Uint64 stepped = 0;
+			for (int f = 0; f < frames; ++f) {
+				scratch.running.resize(0);
+				for (size_t i = 0; i < count; ++i) {
+					if (!chunk[i]->finished) {
+						stepped += chunk[i]->skipQuiet();
+					}
+					if (!chunk[i]->finished) {
+						scratch.running.push(chunk[i]);
+					}
+				}
+				int n = (int)scratch.running.getSize();
+				if (n == 0) {
+					break;
+				}
+
+				// placement networks are evaluated a varying number of times per frame, so they can't share a batch
+				if (control == CONTROL_PLACEMENT) {
+					for (int k = 0; k < n; ++k) {
+						stepped += scratch.running[k]->evaluateCurrent();
+					}
+					continue;
+				}
+
+				// every genome in the chunk whose outputs may have changed is evaluated in one batch call
+				scratch.evaluating.resize(0);
+				scratch.networks.resize(0);
+				for (int k = 0; k < n; ++k) {
+					if (!scratch.running[k]->outputsCurrent()) {
+						scratch.evaluating.push(scratch.running[k]);
+						scratch.networks.push(&scratch.running[k]->network);
+					}
+				}
+				int e = (int)scratch.evaluating.getSize();
+				if (e) {
+					scratch.inputs.resize(inputSize * e);
+					scratch.outputs.resize(AI::Outputs * e);
+					for (int k = 0; k < e; ++k) {
+						scratch.evaluating[k]->fillInputs(scratch.inputs.getArray() + k, e);
+					}
+					scratch.batch.evaluate(scratch.networks.getArray(), e, scratch.inputs.getArray(), scratch.outputs.getArray());
+					for (int k = 0; k < e; ++k) {
+						float controller[Genome::Output::OUT_MAX];
+						for (int o = 0; o < AI::Outputs; ++o) {
+							controller[o] = scratch.outputs[o * e + k];
+						}
+						scratch.evaluating[k]->applyController(controller);
+					}
+				}
+				for (int k = 0; k < n; ++k) {
+					scratch.running[k]->stepGame();
+				}
+				stepped += n;
+			}
+			framesSimulated += stepped;
+			generationFrames += stepped;
+		});
 	}
+	workers->wait();
 
 	return result;
 }
 
+bool AI::processComplete() {
+	focus = nullptr;
+
+	// with racing, genomes run in waves, and the cull thresholds move between waves as this
+	// generation's genomes finish. the wave size doesn't depend on the number of threads, so a
+	// seeded run is abandoned at the same places on any machine
+	size_t wave = racing ? (size_t)RacingWave : SIZE_MAX;
+	size_t queued = 0;
+	updateRacing();
+
+	// genomes don't depend on each other, so every game runs start to finish in its own job
+	Uint64 generationSeed = pool->getGenerationSeed();
+	Uint64 index = 0;
+	for (auto& spec : pool->species) {
+		for (auto& gen : spec.genomes) {
+			Uint64 seed = Random::deriveSeed(generationSeed, index++);
+			if (gen.game && gen.finished) {
+				continue;
+			}
+			Genome* genome = &gen;
+			workers->push([this, genome, seed]() {
+				if (genome->game == nullptr) {
+					genome->initializeRun(seed);
+				}
+				Uint64 stepped = genome->evaluateToEnd();
+				framesSimulated += stepped;
+				generationFrames += stepped;
+			});
+			if (++queued == wave) {
+				workers->wait();
+				updateRacing();
+				queued = 0;
+			}
+		}
+	}
+	workers->wait();
+
+	return true;
+}
+
 void AI::save() {
 	pool->savePool();
 }
 
 void AI::load() {
 	pool->loadPool();
+	generatePieces();
+}
+
+void AI::generatePieces() {
+	// the pieces are a stream of their own, past the ones the generation's games are seeded from
+	if (pieces != PIECES_PER_GAME) {
+		pieceSequences.resize(episodes);
+		for (int e = 0; e < episodes; ++e) {
+			Uint64 pieceSeed = Random::deriveSeed(pool->getGenerationSeed(), Pool::PieceStream - (Uint64)e);
+			pieceSequences[e].generate(pieceSeed, pieces == PIECES_SHARED_BAG ? PieceSequence::ORDER_BAG : PieceSequence::ORDER_RANDOM);
+		}
+	}
+}
+
+void AI::updateRacing() {
+	for (auto& spec : pool->species) {
+		int64_t threshold = racing ? spec.cullThreshold() : INT64_MIN;
+		for (auto& gen : spec.genomes) {
+			gen.abandonBelow = threshold;
+		}
+	}
 }
 
 void AI::nextGeneration() {
-	pool->rand.seedTime();
+	auto now = std::chrono::steady_clock::now();
+	lastGenerationSeconds = std::chrono::duration<double>(now - generationStart).count();
+	lastGenerationFrames = generationFrames.load();
+	mainEngine->fmsg(Engine::MSG_INFO, "generation %d: %llu frames in %.2f sec (%.0f frames/sec, %d threads)",
+		pool->generation, (unsigned long long)lastGenerationFrames, lastGenerationSeconds,
+		lastGenerationSeconds > 0.0 ? (double)lastGenerationFrames / lastGenerationSeconds : 0.0,
+		workers->getNumThreads());
+
+	// breeding has a stream of its own, so it doesn't replay the draws init() mutated the first genomes with
+	pool->rand.seedValue64(Random::deriveSeed(pool->getGenerationSeed(), Pool::BreedStream));
 	pool->newGeneration();
+	generatePieces();
+	mainEngine->fmsg(Engine::MSG_INFO, "bred generation %d in %.2f ms (%.2f ms breeding, %.2f ms speciating)",
+		pool->generation, pool->lastStepSeconds * 1000.0, pool->lastBreedSeconds * 1000.0,
+		pool->lastSpeciateSeconds * 1000.0);
+
+	generationFrames = 0;
+	generationStart = std::chrono::steady_clock::now();
 }
\ No newline at end of file
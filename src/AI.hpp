@@ -9,20 +9,33 @@
 #include "Random.hpp"
 #include "File.hpp"
 #include "Pair.hpp"
+#include "PieceSequence.hpp"
 
 #include <memory>
 #include <atomic>
-#include <future>
+#include <chrono>
+#include <functional>
+#include <mutex>
 #include <vector>
 
+// vector instruction set used by the network kernel
+#if defined(__AVX2__)
+#define NETWORK_AVX2
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define NETWORK_SSE
+#include <emmintrin.h>
+#endif
+
 class Game;
-class Neuron;
 class Network;
+class NetworkBatch;
 class Gene;
 class Genome;
 class Species;
 class Pool;
 class AI;
+class ThreadPool;
 
 class Pool {
 public:
@@ -32,6 +45,62 @@ public:
 
 	int newInnovation();
 
+	// the structural mutation that created a gene. within a generation, the same mutation
+	// gets the same innovation in every genome that makes it
+	struct Innovation {
+		enum Mutation {
+			MUTATE_LINK,		// a new link from into to out
+			MUTATE_SPLIT_IN,	// the first half of the link from into to out, split by a new node
+			MUTATE_SPLIT_OUT,	// the second half of the link from into to out, split by a new node
+		};
+
+		Innovation() {}
+		Innovation(int _into, int _out, Mutation _mutation) :
+			into(_into),
+			out(_out),
+			mutation(_mutation)
+		{}
+
+		bool operator==(const Innovation& other) const {
+			return into == other.into && out == other.out && mutation == other.mutation;
+		}
+
+		unsigned long hash() const {
+			return Map<Uint32, int>::mix((Uint32)into * 31u + Map<Uint32, int>::mix((Uint32)out * 3u + (Uint32)mutation));
+		}
+
+		int into = 0;
+		int out = 0;
+		Mutation mutation = MUTATE_LINK;
+	};
+
+	// what a mutation made this generation was numbered
+	struct Registered {
+		int innovation = 0;
+		int neuron = 0;		// the node added by a MUTATE_SPLIT_IN, shared by every genome that makes the split
+	};
+
+	// look up the numbers for a mutation made this generation, numbering it if it is new.
+	// safe to call from any thread
+	// @param mutation the mutation
+	// @return its innovation, and the new node if it splits a link
+	Registered registerInnovation(const Innovation& mutation);
+
+	// @return a hidden node id that no genome in the pool has used
+	int newNeuron();
+
+	// innovations handed out while breeding are placeholders counting up from here, so children
+	// can be bred on any thread. resolveInnovations() gives them their real numbers afterwards
+	static const int PendingInnovation = 1 << 30;
+
+	// the node added by a split is a placeholder too, PendingNeuron plus the index of the split's
+	// MUTATE_SPLIT_IN placeholder. it is well above AI::MaxNodes and the output nodes
+	static const int PendingNeuron = 1 << 29;
+
+	// number a freshly bred genome's placeholder innovations, in gene order
+	// @param genome the genome to number
+	void resolveInnovations(Genome& genome);
+
 	void rankGlobally();
 
 	int64_t totalAverageFitness();
@@ -42,7 +111,9 @@ public:
 
 	void removeWeakSpecies();
 
-	void addToSpecies(Genome& child);
+	// @param child the genome to place
+	// @param firstSpecies the first species to compare against, the ones before it are known not to match
+	void addToSpecies(Genome&& child, int firstSpecies = 0);
 
 	void newGeneration();
 
@@ -58,14 +129,47 @@ public:
 	// @param file interface to serialize with
 	void serialize(FileInterface * file);
 
+	// @return the seed of the current generation. every stream the generation draws from is derived
+	// from it: each genome's game from Random::deriveSeed(getGenerationSeed(), its index in the pool),
+	// and the rest from the streams below
+	Uint64 getGenerationSeed() const { return Random::deriveSeed(seed, (Uint64)generation); }
+
+	// streams of a generation that aren't genome games, far above any genome's index
+	static const Uint64 InitStream = (Uint64)1 << 63;		// rand, while init() mutates the first genomes
+	static const Uint64 BreedStream = InitStream + 1;		// rand, while newGeneration() breeds the next generation
+	static const Uint64 PieceStream = ~(Uint64)0;			// the shared pieces of episode e are PieceStream - e
+
 	int generation = 0;
 	int innovation;
+	int neuron = 0;		// the highest hidden node id handed out, see newNeuron()
 	std::atomic<int64_t> maxFitness { 0 };
 	ArrayList<Species> species;
 	int inputSize = 0;
-	Random rand;
+	Uint64 seed = 0;	// seed of the whole run
+	Random rand { Random::ALG_XOSHIRO };
 
 	AI* ai = nullptr;
+
+	// innovations (and split nodes) handed out this generation, by the mutation that made them
+	Map<Innovation, Registered> innovations;
+	std::mutex innovationLock;
+
+	// time spent in the last newGeneration()
+	double lastStepSeconds = 0.0;		// the whole generation step
+	double lastBreedSeconds = 0.0;		// breeding and mutating children
+	double lastSpeciateSeconds = 0.0;	// sorting children into species
+
+private:
+	// breed one child per entry of parents onto the end of children. every child draws from
+	// its own stream, seeded in child order from rand, so the result doesn't depend on threading
+	// @param parents the species to breed each child from
+	// @param children the list to add the children to
+	void breedChildren(const ArrayList<int>& parents, ArrayList<Genome>& children);
+
+	// call fn for every index in [0, count), spread over the AI's workers if there are any
+	// @param count the number of indices
+	// @param fn the function to call
+	void forEach(size_t count, const std::function<void(size_t)>& fn);
 };
 
 class AI {
@@ -77,12 +181,68 @@ public:
 	int getGeneration() const { return pool ? pool->generation : 0; }
 	int64_t getMaxFitness() const { return pool ? pool->maxFitness.load() : 0; }
 	int getMeasured() const;
+	Uint64 getFramesSimulated() const { return framesSimulated.load(); }
+	int getBatchFrames() const { return batchFrames; }
+	int getBatchGenomes() const { return batchGenomes; }
+	Uint64 getGenerationFrames() const { return generationFrames.load(); }
+	double getLastGenerationSeconds() const { return lastGenerationSeconds; }
+	Uint64 getLastGenerationFrames() const { return lastGenerationFrames; }
+	double getLastStepSeconds() const { return pool ? pool->lastStepSeconds : 0.0; }
+	double getLastBreedSeconds() const { return pool ? pool->lastBreedSeconds : 0.0; }
+	double getLastSpeciateSeconds() const { return pool ? pool->lastSpeciateSeconds : 0.0; }
+	ThreadPool* getWorkers() const { return workers; }
+	Uint64 getSeed() const { return seed; }
+
+	void setBatchFrames(int frames) { batchFrames = std::max(1, frames); }
+	void setBatchGenomes(int genomes) { batchGenomes = std::max(1, genomes); }
+
+	// evaluation modes
+	enum Evaluation {
+		EVAL_LOCKSTEP,		// each process() steps every genome through a batch of frames
+		EVAL_COMPLETE,		// each process() plays every genome's game to the end, one job per genome
+	};
+
+	// where each game's pieces come from
+	enum Pieces {
+		PIECES_PER_GAME,	// every game draws its own from its seed
+		PIECES_SHARED,		// every game in a generation deals from one sequence, so they can be compared fairly
+		PIECES_SHARED_BAG,	// like PIECES_SHARED, with the sequence drawn from shuffled bags of all seven pieces
+	};
+
+	// how a genome plays
+	enum Control {
+		CONTROL_JOYPAD,		// the network is evaluated every frame and its outputs held as buttons
+		CONTROL_PLACEMENT,	// the network scores the board after each place a piece can land, and the best is taken
+	};
+
+	Evaluation getEvaluation() const { return evaluation; }
+	Uint32 getFrameBudget() const { return frameBudget; }
+	int64_t getCutoffFitness() const { return cutoffFitness; }
+	Pieces getPieces() const { return pieces; }
+	int getEpisodes() const { return episodes; }
+	bool getRacing() const { return racing; }
+	Control getControl() const { return control; }
+	bool getTimeSkip() const { return timeSkip; }
+
+	// @param episode which of a genome's games
+	// @return the sequence this generation's games deal that episode from, or nullptr if each game draws its own
+	const PieceSequence* getPieceSequence(int episode) const { return pieces == PIECES_PER_GAME ? nullptr : &pieceSequences[episode]; }
+
+	void setEvaluation(Evaluation _evaluation) { evaluation = _evaluation; }
+	void setFrameBudget(Uint32 frames) { frameBudget = frames; }
+	void setCutoffFitness(int64_t _fitness) { cutoffFitness = _fitness; }
+	void setSeed(Uint64 _seed) { seed = _seed; }
+	void setPieces(Pieces _pieces) { pieces = _pieces; }
+	void setEpisodes(int _episodes) { episodes = std::max(1, _episodes); }
+	void setRacing(bool _racing) { racing = _racing; }
+	void setControl(Control _control) { control = _control; }
+	void setTimeSkip(bool _timeSkip) { timeSkip = _timeSkip; }
 
 	// setup
 	void init();
 
-	// step the AI one frame
-	// @return true if a genome's fitness was still being measured, otherwise false
+	// step the AI one frame (or one whole generation, see EVAL_COMPLETE)
+	// @return true if every genome's fitness has been measured, otherwise false
 	bool process();
 
 	// save AI
@@ -119,25 +279,144 @@ public:
 
 	static const int MaxNodes;
 
+	static const int DefaultBatchGenomes;
+	static const int RacingWave;
+
 	std::shared_ptr<Game> focus { nullptr };
 
 private:
 	Pool* pool = nullptr;
+	ThreadPool* workers = nullptr;
+
+	int batchFrames = 1;					// frames each job steps a genome before synchronizing
+	int batchGenomes = DefaultBatchGenomes;	// genomes handed to each job
+	Evaluation evaluation = EVAL_LOCKSTEP;
+	Uint32 frameBudget = 0;					// frames after which a run is ended (0 = no limit)
+	int64_t cutoffFitness = 0;				// fitness at which a run is ended early (0 = no limit)
+	Uint64 seed = 0;						// seed of the run, every random draw follows from it (0 = pick one at init)
+	Pieces pieces = PIECES_SHARED;
+	ArrayList<PieceSequence> pieceSequences;	// this generation's pieces for each episode, read by every game at once
+	int episodes = 1;						// games each genome plays, its fitness is their mean
+	bool racing = false;					// abandon genomes that can no longer survive the cull (needs a frame budget)
+	Control control = CONTROL_JOYPAD;
+	bool timeSkip = false;					// let genomes jump over frames in which nothing can happen, see Genome::skipQuiet()
+
+	// draw this generation's piece sequences
+	void generatePieces();
+
+	// tell every unfinished genome what it has to be able to reach to keep running, see racing
+	void updateRacing();
+
+	// lockstep evaluation, see EVAL_LOCKSTEP
+	// @return true if every genome has finished
+	bool processLockstep();
+
+	// run-to-completion evaluation, see EVAL_COMPLETE
+	// @return true if every genome has finished
+	bool processComplete();
+
+	// throughput
+	std::atomic<Uint64> framesSimulated { 0 };	// total genome frames stepped since init
+	std::atomic<Uint64> generationFrames { 0 };	// genome frames stepped this generation
+	std::chrono::steady_clock::time_point generationStart;
+	double lastGenerationSeconds = 0.0;
+	Uint64 lastGenerationFrames = 0;
 };
 
-class Neuron {
+// a genome's neural net compiled into a flat evaluation plan.
+// every neuron gets a dense index: the inputs come first, followed by every other neuron in
+// topological order, so one linear pass over the plan evaluates the whole network.
+// connections that close a cycle read the value their source had on the previous evaluation.
+class Network {
 public:
-	Neuron() {}
+	Network() {}
+
+	// rebuild the plan from a genome's genes
+	// @param genes the genes to build from (disabled genes are skipped)
+	// @param _inputSize the number of network inputs
+	void compile(const ArrayList<Gene>& genes, int _inputSize);
+
+	// evaluate the network with the vectorized kernel (SSE/AVX2 when available)
+	// @param inputs inputSize input values
+	// @param outputs AI::Outputs values to fill
+	void evaluate(const float* inputs, float* outputs);
+
+	// evaluate the network one connection at a time with the exact sigmoid
+	// @param inputs inputSize input values
+	// @param outputs AI::Outputs values to fill
+	void evaluateScalar(const float* inputs, float* outputs);
+
+	// @return the number of neurons in the network, including inputs
+	size_t getNumNeurons() const { return values.getSize(); }
+
+	// @return true if the other network has the same neurons and connections (weights may differ)
+	bool sameTopology(const Network& other) const;
+
+	// exact activation function
+	static float sigmoid(float x);
 
-	ArrayList<Gene*> incoming;
-	float value = 0.f;
+	// polynomial approximation of sigmoid() used by the vectorized kernel. gives exactly what the
+	// vector instructions give for the same value
+	static float sigmoidFast(float x);
+
+	// the largest difference evaluate() may have from evaluateScalar() on each output. it grows with
+	// the depth of the network and the number and size of the terms each neuron sums
+	// @param tolerances AI::Outputs values to fill, going by the neuron values left by evaluateScalar()
+	void kernelTolerance(float* tolerances) const;
+
+	int inputSize = 0;
+	ArrayList<float> values;	// neuron values by dense index
+	ArrayList<int> offsets;		// connections into neuron (inputSize + n) are [offsets[n], offsets[n + 1])
+	ArrayList<int> sources;		// dense index of each connection's source neuron
+	ArrayList<float> weights;	// weight of each connection
+	ArrayList<int> outputs;		// dense index of each output neuron
+	ArrayList<int> levels;		// neurons [levels[l], levels[l + 1]) only read neurons from earlier levels
+	Uint32 topology = 0;		// hash of the layout, see sameTopology()
+	bool recurrent = false;		// true if some connection reads a value from the previous evaluation
+
+private:
+	// evaluate the plan against the given neuron values
+	// @param v neuron values to read and update
+	// @param inputs inputSize input values
+	// @param outputs AI::Outputs values to fill
+	// @param vectorized true to use the vectorized kernel
+	void run(float* v, const float* inputs, float* outputs, bool vectorized) const;
+
+	friend class NetworkBatch;
 };
 
-class Network {
+// evaluates many networks in one call. networks that share a topology (e.g. clones from
+// Species::breedChild that haven't had a structural mutation) are run together, one lane per
+// network, so the inner loops vectorize across genomes. scratch memory is kept between calls.
+class NetworkBatch {
 public:
-	Network() {}
+	NetworkBatch() {}
 
-	Map<int, Neuron> neurons;
+	// evaluate a batch of networks
+	// @param networks the networks to evaluate
+	// @param count the number of networks
+	// @param inputs structure-of-arrays inputs, input i of network g is inputs[i * count + g]
+	// @param outputs structure-of-arrays outputs, output o of network g is written to outputs[o * count + g]
+	void evaluate(Network* const* networks, int count, const float* inputs, float* outputs);
+
+private:
+	// evaluate a network that shares its topology with nobody else in the batch
+	void evaluateOne(Network* const* networks, int count, int index, const float* inputs, float* outputs);
+
+	// evaluate every network in members together
+	void evaluateGroup(Network* const* networks, int count, const float* inputs, float* outputs);
+
+	ArrayList<bool> done;		// networks already evaluated this call
+	ArrayList<int> members;		// networks in the current topology group
+	ArrayList<float> values;	// interleaved neuron values of the group
+	ArrayList<float> weights;	// interleaved weights of the group
+	ArrayList<float> sums;		// one running sum per lane
+	ArrayList<float> partials;	// partial sums per lane, see weightedSum()
+	ArrayList<float> column;	// inputs of a lone network
+
+#ifdef BUILD_DEBUG
+	ArrayList<float> reference;	// each lane's neuron values before the call, for checking the group kernel
+#endif
 };
 
 class Gene {
@@ -186,35 +465,107 @@ class Genome {
 public:
 	Genome();
 	Genome(const Genome& src);
+	Genome(Genome&& src);
 
 	Genome& operator=(const Genome& src);
+	Genome& operator=(Genome&& src);
 
-	void mutate();
+	// @return how many times any genome has been copied since the program started
+	static Uint64 getNumCopies() { return numCopies.load(); }
 
-	int randomNeuron(bool nonInput);
+	// @return how many times any genome has been moved since the program started
+	static Uint64 getNumMoves() { return numMoves.load(); }
+
+	// the mutations draw from the given stream rather than the pool's, so that children can be
+	// mutated on any thread. new genes get placeholder innovations, see Pool::resolveInnovations()
+	// @param rand the stream to draw from
+	void mutate(Random& rand);
+
+	int randomNeuron(bool nonInput, Random& rand);
 
 	bool containsLink(const Gene& link);
 
-	void pointMutate();
+	void pointMutate(Random& rand);
 
-	void linkMutate(bool forceBias);
+	void linkMutate(bool forceBias, Random& rand);
 
-	void nodeMutate();
+	void nodeMutate(Random& rand);
 
 	void generateNetwork();
 
-	void enableDisableMutate(bool enable);
+	void enableDisableMutate(bool enable, Random& rand);
+
+	// @param mutation the mutation that makes the new gene
+	// @return a placeholder innovation for the new gene, above any this genome already has
+	int newInnovation(const Pool::Innovation& mutation);
+
+	// add a gene, keeping genes sorted by innovation
+	// @param gene the gene to add
+	void addGene(const Gene& gene);
+
+	// @return true if genes are sorted by innovation
+	bool genesSorted() const;
 
 	ArrayList<float> evaluateNetwork(ArrayList<float>& inputs);
 
-	void initializeRun();
+	// start a new game
+	// @param seed the seed for the game's pieces
+	void initializeRun(Uint64 seed);
+
+	// forget the last run and its fitness, so the genome plays the next generation's games
+	// from the start like everyone else
+	void resetRun();
 
 	void clearJoypad();
 
-	void evaluateCurrent();
+	// step the game, evaluating the network if it has to be
+	// @return the number of frames stepped, more than one if quiet frames were skipped
+	Uint32 evaluateCurrent();
+
+	// @return true if the network would give the outputs it gave last time, because time skipping is
+	// on, the network doesn't remember earlier evaluations, and the game hasn't changed since
+	bool outputsCurrent() const;
+
+	// with time skipping on, run through the frames in which the held outputs can't change anything,
+	// so that the next frame is one in which something happens. tick-exact with stepping each frame
+	// @return the number of frames skipped
+	Uint32 skipQuiet();
+
+	// evaluate frames until the run is finished
+	// @return the number of frames stepped
+	Uint32 evaluateToEnd();
+
+	// end the current game, and start the next episode if there is one
+	void finishEpisode();
+
+	// end the run and record the final fitness
+	void finishRun();
+
+	// @return the highest fitness this run could still end with, or INT64_MAX if games have no frame budget
+	int64_t fitnessBound() const;
 
 	ArrayList<float> getInputs();
 
+	// write the network inputs for the current game state
+	// @param inputs where to write pool->inputSize values
+	// @param stride distance between consecutive inputs (1 for a plain array)
+	void fillInputs(float* inputs, size_t stride);
+
+	// with CONTROL_PLACEMENT, score every place the new piece can land and put it in the best one.
+	// does nothing unless a piece is waiting to be placed
+	// @param inputs scratch space for pool->inputSize values
+	void placePiece(float* inputs);
+
+	// set the joypad from network outputs
+	// @param controller AI::Outputs network outputs
+	void applyController(const float* controller);
+
+	// advance the game one frame with the current joypad and update fitness
+	void stepGame();
+
+	// update fitness after a frame, and end the episode or run if it is over
+	void recordFrame();
+
 	// save/load this object to a file
 	// @param file interface to serialize with
 	void serialize(FileInterface * file);
@@ -230,10 +581,19 @@ public:
 
 	int framesSurvived = 0;
 	Uint32 currentFrame = 0;
+	Uint64 runSeed = 0;					// seed of the first episode's game
+	int episode = 0;					// episodes finished
+	int64_t episodeFitness = 0;			// fitness of the current episode
+	int64_t episodeTotal = 0;			// fitness of the finished episodes added up
+	int64_t abandonBelow = INT64_MIN;	// the run is given up once fitnessBound() falls below this
+	Uint32 evaluatedChanges = 0;		// game->changes when the outputs were last set by the network
 	std::shared_ptr<Game> game { nullptr };
 	bool finished = false;
 	float totalDanger = 0.f;
 
+	// the mutations behind each placeholder innovation, see Pool::resolveInnovations()
+	ArrayList<Pool::Innovation> pendingInnovations;
+
 	// controller outputs
 	enum Output {
 		OUT_DOWN,
@@ -245,6 +605,9 @@ public:
 	};
 	float outputs[Output::OUT_MAX];
 
+	static std::atomic<Uint64> numCopies;
+	static std::atomic<Uint64> numMoves;
+
 	class AscSortPtr : public ArrayList<Genome*>::SortFunction {
 	public:
 		AscSortPtr() {}
@@ -264,16 +627,33 @@ public:
 			return a.fitness > b.fitness;
 		}
 	};
-
-private:
-	static float sigmoid(float x);
 };
 
 class Species {
 public:
 	Species() {}
+	Species(const Species& src) = default;
+	Species(Species&& src) = default;
+
+	Species& operator=(const Species& src) = default;
+	Species& operator=(Species&& src) = default;
 
-	Genome crossover(Genome* g1, Genome* g2);
+	Genome crossover(Genome* g1, Genome* g2, Random& rand);
+
+	// the parts of the NEAT distance between two genomes
+	struct Distance {
+		int excess = 0;				// genes past the last innovation of the other genome
+		int disjoint = 0;			// unmatched genes within the other genome's range
+		int matching = 0;			// genes both genomes have
+		float disjointDelta = 0.f;	// (excess + disjoint) / larger gene count, see disjoint()
+		float weightDelta = 0.f;	// mean weight difference of matching genes, see weights()
+	};
+
+	// compare two genomes in one walk over their innovation-sorted genes
+	// @param g1 the first genome
+	// @param g2 the second genome
+	// @return the distance between them
+	Distance distance(const Genome* g1, const Genome* g2) const;
 
 	float disjoint(Genome* g1, Genome* g2);
 
@@ -283,7 +663,13 @@ public:
 
 	void calculateAverageFitness();
 
-	Genome breedChild();
+	// @return the fitness a genome has to beat to survive the next cull, going by the genomes that
+	// have finished, or INT64_MIN while too few have finished to tell
+	int64_t cullThreshold() const;
+
+	// @param rand the stream to draw from
+	// @return a new child of this species
+	Genome breedChild(Random& rand);
 
 	// save/load this object to a file
 	// @param file interface to serialize with
@@ -0,0 +1,152 @@
+// Allocations.cpp
+
+#include "Main.hpp"
+#include "Allocations.hpp"
+
+#include <new>
+
+#ifndef COUNT_ALLOCATIONS
+
+Uint64 Allocations::getCount() {
+	return 0;
+}
+
+#else
+
+static thread_local Uint64 allocations = 0;
+
+Uint64 Allocations::getCount() {
+	return allocations;
+}
+
+#ifdef __cpp_aligned_new
+static void* alignedMalloc(size_t size, size_t alignment) {
+#ifdef _MSC_VER
+	return _aligned_malloc(size ? size : 1, alignment);
+#else
+	void* ptr = nullptr;
+	return posix_memalign(&ptr, alignment, size ? size : 1) == 0 ? ptr : nullptr;
+#endif
+}
+
+static void alignedFree(void* ptr) {
+#ifdef _MSC_VER
+	_aligned_free(ptr);
+#else
+	free(ptr);
+#endif
+}
+#endif
+
+// route every allocation through malloc so we can count it
+
+void* operator new(size_t size) {
+	++allocations;
+	void* ptr = malloc(size ? size : 1);
+	if (!ptr) {
+		throw std::bad_alloc();
+	}
+	return ptr;
+}
+
+void* operator new[](size_t size) {
+	++allocations;
+	void* ptr = malloc(size ? size : 1);
+	if (!ptr) {
+		throw std::bad_alloc();
+	}
+	return ptr;
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+	++allocations;
+	return malloc(size ? size : 1);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+	++allocations;
+	return malloc(size ? size : 1);
+}
+
+void operator delete(void* ptr) noexcept {
+	free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+	free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+	free(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept {
+	free(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+	free(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept {
+	free(ptr);
+}
+
+// over-aligned types come through these (C++17 and up), and can't share malloc's blocks on every platform
+#ifdef __cpp_aligned_new
+
+void* operator new(size_t size, std::align_val_t alignment) {
+	++allocations;
+	void* ptr = alignedMalloc(size, (size_t)alignment);
+	if (!ptr) {
+		throw std::bad_alloc();
+	}
+	return ptr;
+}
+
+void* operator new[](size_t size, std::align_val_t alignment) {
+	++allocations;
+	void* ptr = alignedMalloc(size, (size_t)alignment);
+	if (!ptr) {
+		throw std::bad_alloc();
+	}
+	return ptr;
+}
+
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+	++allocations;
+	return alignedMalloc(size, (size_t)alignment);
+}
+
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+	++allocations;
+	return alignedMalloc(size, (size_t)alignment);
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept {
+	alignedFree(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t) noexcept {
+	alignedFree(ptr);
+}
+
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept {
+	alignedFree(ptr);
+}
+
+void operator delete[](void* ptr, size_t, std::align_val_t) noexcept {
+	alignedFree(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept {
+	alignedFree(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept {
+	alignedFree(ptr);
+}
+
+#endif
+
+#endif
@@ -0,0 +1,36 @@
+// Allocations.hpp
+// Counts heap allocations per thread, so hot loops can check that they don't touch the heap
+
+#pragma once
+
+#include "Main.hpp"
+
+// counting replaces the global allocation operators, which costs every allocation in the program
+// a little, so it is only built into debug builds unless COUNT_ALLOCATIONS is defined
+#if defined(BUILD_DEBUG) && !defined(COUNT_ALLOCATIONS)
+#define COUNT_ALLOCATIONS
+#endif
+
+class Allocations {
+public:
+#ifdef COUNT_ALLOCATIONS
+	static constexpr bool counting = true;
+#else
+	static constexpr bool counting = false;	// getCount() is always 0
+#endif
+
+	// @return the number of times the calling thread has called operator new
+	static Uint64 getCount();
+
+	// counts the allocations made by the calling thread while it is in scope
+	class Scope {
+	public:
+		Scope() : start(getCount()) {}
+
+		// @return allocations made since the scope was opened
+		Uint64 getCount() const { return Allocations::getCount() - start; }
+
+	private:
+		Uint64 start;
+	};
+};
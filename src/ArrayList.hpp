@@ -7,20 +7,33 @@
 #include <luajit-2.0/lua.hpp>
 #include <LuaBridge/LuaBridge.h>
 
+#include <memory>
+#include <new>
+
 // templated ArrayList (similar to std::vector)
 // adding or removing elements can unsort the list.
 // @param T generic type that the list will contain
 template <typename T>
 class ArrayList {
 public:
-	ArrayList() {
-		alloc(4);
-	}
+	// an empty list doesn't allocate until something is pushed into it
+	ArrayList() {}
 
 	ArrayList(const ArrayList& src) {
 		copy(src);
 	}
 
+	// takes the other list's array, leaving it empty
+	ArrayList(ArrayList&& src) :
+		arr(src.arr),
+		size(src.size),
+		maxSize(src.maxSize)
+	{
+		src.arr = nullptr;
+		src.size = 0;
+		src.maxSize = 0;
+	}
+
 	ArrayList(const std::initializer_list<T>& src) {
 		copy(src);
 	}
@@ -204,6 +217,29 @@ public:
 		arr[size-1] = val;
 	}
 
+	// move a value onto the list
+	// @param val the value to push
+	void push(T&& val) {
+		if( size==maxSize ) {
+			alloc(std::max((unsigned int)size*2U, 4U));
+		}
+		++size;
+		arr[size-1] = std::move(val);
+	}
+
+	// construct a value at the end of the list
+	// @param args arguments to the value's constructor
+	// @return the new value
+	template <typename... Args>
+	T& emplace(Args&&... args) {
+		if( size==maxSize ) {
+			alloc(std::max((unsigned int)size*2U, 4U));
+		}
+		++size;
+		arr[size-1] = T(std::forward<Args>(args)...);
+		return arr[size-1];
+	}
+
 	// insert a value into the list
 	// @param val the value to insert
 	// @param pos the index to displace (move to the end of the list)
@@ -213,7 +249,7 @@ public:
 			alloc(std::max((unsigned int)size*2U, 4U));
 		}
 		++size;
-		arr[size-1] = arr[pos];
+		arr[size-1] = std::move(arr[pos]);
 		arr[pos] = val;
 	}
 
@@ -227,7 +263,7 @@ public:
 		}
 		++size;
 		for( size_t c = size-1; c > pos; --c ) {
-			arr[c] = arr[c-1];
+			arr[c] = std::move(arr[c-1]);
 		}
 		arr[pos] = val;
 	}
@@ -237,7 +273,7 @@ public:
 	T pop() {
 		assert(size > 0);
 		--size;
-		return arr[size];
+		return std::move(arr[size]);
 	}
 
 	// returns the last element in the list without removing it
@@ -259,9 +295,11 @@ public:
 	// @return the value at the given index
 	T remove(size_t pos) {
 		assert(size > pos);
-		T result = arr[pos];
+		T result = std::move(arr[pos]);
 		--size;
-		arr[pos] = arr[size];
+		if( pos != size ) {
+			arr[pos] = std::move(arr[size]);
+		}
 		return result;
 	}
 
@@ -270,11 +308,11 @@ public:
 	// @return the value at the given index
 	T removeAndRearrange(size_t pos) {
 		assert(size > pos);
-		T result = arr[pos];
+		T result = std::move(arr[pos]);
 
 		size_t newSize = size - 1;
 		for( size_t c = pos; c < newSize; ++c ) {
-			arr[c] = arr[c+1];
+			arr[c] = std::move(arr[c+1]);
 		}
 
 		--size;
@@ -288,6 +326,24 @@ public:
 		return copy(src);
 	}
 
+	// take the contents of another list, leaving it empty
+	// @param src the list to take from
+	// @return *this;
+	ArrayList& operator=(ArrayList&& src) {
+		if( this != &src ) {
+			if( arr ) {
+				delete[] arr;
+			}
+			arr = src.arr;
+			size = src.size;
+			maxSize = src.maxSize;
+			src.arr = nullptr;
+			src.size = 0;
+			src.maxSize = 0;
+		}
+		return *this;
+	}
+
 	// replace list contents with those of an array
 	// @param src the array to copy into our list
 	// @return *this;
@@ -340,25 +396,42 @@ public:
 		virtual const bool operator()(const T& a, const T& b) const = 0;
 	};
 
+	// sort the list in place (introsort). equal elements may change order
+	// @param less returns true if a should be placed before b
+	template <typename Compare>
+	void sort(const Compare& less) {
+		if (size > 1) {
+			size_t depth = 0;
+			for (size_t n = size; n > 1; n >>= 1) {
+				depth += 2;
+			}
+			introSort(0, size, depth, less);
+		}
+	}
+
 	// sort the array list using the given function
 	// @param fn The sort function to use
 	void sort(const SortFunction& fn) {
-		ArrayList<T> result;
-		result.alloc(size);
-		for (int c = 0; c < size; ++c) {
-			bool foundPlace = false;
-			for (int i = 0; i < result.getSize(); ++i) {
-				if (fn(arr[c], result[i])) {
-					result.insertAndRearrange(arr[c], i);
-					foundPlace = true;
-					break;
-				}
-			}
-			if (!foundPlace) {
-				result.push(arr[c]);
-			}
+		sort([&fn](const T& a, const T& b) { return fn(a, b); });
+	}
+
+	// sort the list (merge sort), keeping equal elements in the order they were in
+	// @param less returns true if a should be placed before b
+	template <typename Compare>
+	void stableSort(const Compare& less) {
+		if (size > 1) {
+			// raw storage, elements only live in it while a merge needs them
+			std::allocator<T> allocator;
+			T* buffer = allocator.allocate(size / 2);
+			mergeSort(0, size, buffer, less);
+			allocator.deallocate(buffer, size / 2);
 		}
-		swap(result);
+	}
+
+	// stable sort the array list using the given function
+	// @param fn The sort function to use
+	void stableSort(const SortFunction& fn) {
+		stableSort([&fn](const T& a, const T& b) { return fn(a, b); });
 	}
 
 	// exposes this list type to a script
@@ -374,6 +447,9 @@ public:
 		typedef ArrayList<T>& (ArrayList<T>::*CopyFn)(const ArrayList<T>&);
 		CopyFn copy = static_cast<CopyFn>(&ArrayList<T>::copy);
 
+		typedef void (ArrayList<T>::*PushFn)(const T&);
+		PushFn push = static_cast<PushFn>(&ArrayList<T>::push);
+
 		typedef T& (ArrayList<T>::*PeekFn)();
 		PeekFn peek = static_cast<PeekFn>(&ArrayList<T>::peek);
 
@@ -398,7 +474,7 @@ public:
 			.addFunction("resize", &ArrayList<T>::resize)
 			.addFunction("clear", &ArrayList<T>::clear)
 			.addFunction("copy", copy)
-			.addFunction("push", &ArrayList<T>::push)
+			.addFunction("push", push)
 			.addFunction("insert", &ArrayList<T>::insert)
 			.addFunction("pop", &ArrayList<T>::pop)
 			.addFunction("peek", peek)
@@ -412,6 +488,138 @@ public:
 	}
 
 private:
+	static const size_t sortThreshold = 16;	// ranges this small are insertion sorted
+
+	// insertion sort a range of the list. stable
+	template <typename Compare>
+	void insertionSort(size_t begin, size_t end, const Compare& less) {
+		for (size_t c = begin + 1; c < end; ++c) {
+			if (!less(arr[c], arr[c - 1])) {
+				continue;
+			}
+			T value = std::move(arr[c]);
+			size_t i = c;
+			do {
+				arr[i] = std::move(arr[i - 1]);
+				--i;
+			} while (i > begin && less(value, arr[i - 1]));
+			arr[i] = std::move(value);
+		}
+	}
+
+	// restore the heap property below one element of a heap stored at arr[base]
+	template <typename Compare>
+	void siftDown(size_t base, size_t i, size_t n, const Compare& less) {
+		while (1) {
+			size_t child = i * 2 + 1;
+			if (child >= n) {
+				break;
+			}
+			if (child + 1 < n && less(arr[base + child], arr[base + child + 1])) {
+				++child;
+			}
+			if (!less(arr[base + i], arr[base + child])) {
+				break;
+			}
+			std::swap(arr[base + i], arr[base + child]);
+			i = child;
+		}
+	}
+
+	// heap sort a range of the list, for when quicksort keeps picking bad pivots
+	template <typename Compare>
+	void heapSort(size_t begin, size_t end, const Compare& less) {
+		size_t n = end - begin;
+		for (size_t i = n / 2; i-- > 0; ) {
+			siftDown(begin, i, n, less);
+		}
+		for (size_t i = n - 1; i > 0; --i) {
+			std::swap(arr[begin], arr[begin + i]);
+			siftDown(begin, 0, i, less);
+		}
+	}
+
+	// quicksort with a median of three pivot, falling back to heap sort past a depth limit
+	template <typename Compare>
+	void introSort(size_t begin, size_t end, size_t depth, const Compare& less) {
+		while (end - begin > sortThreshold) {
+			if (depth == 0) {
+				heapSort(begin, end, less);
+				return;
+			}
+			--depth;
+
+			// move the median of three to the front, it becomes the pivot. the other two
+			// guarantee neither scan below can run off the end of the range
+			size_t a = begin + 1, b = begin + (end - begin) / 2, c = end - 1;
+			if (less(arr[b], arr[a])) {
+				std::swap(a, b);
+			}
+			if (less(arr[c], arr[b])) {
+				b = less(arr[c], arr[a]) ? a : c;
+			}
+			std::swap(arr[begin], arr[b]);
+
+			// partition around the pivot
+			size_t left = begin + 1, right = end;
+			while (1) {
+				while (less(arr[left], arr[begin])) {
+					++left;
+				}
+				--right;
+				while (less(arr[begin], arr[right])) {
+					--right;
+				}
+				if (left >= right) {
+					break;
+				}
+				std::swap(arr[left], arr[right]);
+				++left;
+			}
+
+			// recurse into the right side, loop on the left
+			introSort(left, end, depth, less);
+			end = left;
+		}
+		insertionSort(begin, end, less);
+	}
+
+	// merge sort a range of the list. stable
+	// @param buffer scratch space for half the range
+	template <typename Compare>
+	void mergeSort(size_t begin, size_t end, T* buffer, const Compare& less) {
+		if (end - begin <= sortThreshold) {
+			insertionSort(begin, end, less);
+			return;
+		}
+		size_t mid = begin + (end - begin) / 2;
+		mergeSort(begin, mid, buffer, less);
+		mergeSort(mid, end, buffer, less);
+		if (!less(arr[mid], arr[mid - 1])) {
+			return; // already in order
+		}
+
+		// move the left half out of the way and merge both halves back in
+		size_t leftSize = mid - begin;
+		for (size_t c = 0; c < leftSize; ++c) {
+			new (&buffer[c]) T(std::move(arr[begin + c]));
+		}
+		size_t l = 0, r = mid, out = begin;
+		while (l < leftSize && r < end) {
+			if (less(arr[r], buffer[l])) {
+				arr[out++] = std::move(arr[r++]);
+			} else {
+				arr[out++] = std::move(buffer[l++]);
+			}
+		}
+		while (l < leftSize) {
+			arr[out++] = std::move(buffer[l++]);
+		}
+		for (size_t c = 0; c < leftSize; ++c) {
+			buffer[c].~T();
+		}
+	}
+
 	T* arr = nullptr;		// array data
 	size_t size = 0;		// current array capacity
 	size_t maxSize = 0;		// maximum array capacity
@@ -0,0 +1,517 @@
+// Bench.cpp
+
+#include "Main.hpp"
+#include "Engine.hpp"
+#include "Bench.hpp"
+#include "Allocations.hpp"
+#include "AI.hpp"
+#include "Game.hpp"
+#include "Map.hpp"
+#include "File.hpp"
+
+// keeps the optimizer from throwing away results we don't otherwise use
+static volatile Uint64 sink = 0;
+
+// the Map that came before the open-addressing one: a list per bucket, at most one pair per
+// bucket before it doubles, and keys used as their own hash. kept to benchmark against
+template <typename K, typename T>
+class LegacyMap {
+public:
+	LegacyMap() {
+		data.resize(numBuckets);
+	}
+
+	void clear() {
+		for (auto& bucket : data) {
+			bucket.clear();
+		}
+		size = 0;
+	}
+
+	void insert(const K& key, const T& value) {
+		T* oldValue = find(key);
+		if (oldValue) {
+			*oldValue = value;
+			return;
+		}
+		if (size + 1 >= numBuckets) {
+			rehash(numBuckets * 2);
+		}
+		data[(size_t)key & (numBuckets - 1)].push(OrderedPair<K, T>(key, value));
+		++size;
+	}
+
+	void rehash(size_t newBucketCount) {
+		ArrayList<OrderedPair<K, T>> list;
+		for (auto& bucket : data) {
+			for (auto& pair : bucket) {
+				list.push(pair);
+			}
+		}
+		clear();
+		numBuckets = newBucketCount;
+		data.resize(numBuckets);
+		for (auto& pair : list) {
+			insert(pair.a, pair.b);
+		}
+	}
+
+	T* find(const K& key) {
+		for (auto& pair : data[(size_t)key & (numBuckets - 1)]) {
+			if (pair.a == key) {
+				return &pair.b;
+			}
+		}
+		return nullptr;
+	}
+
+private:
+	ArrayList<ArrayList<OrderedPair<K, T>>> data;
+	size_t numBuckets = 4;
+	size_t size = 0;
+};
+
+Bench::Bench(const char* _filename) {
+	filename = _filename;
+}
+
+bool Bench::run() {
+	mainEngine->fmsg(Engine::MSG_INFO, "running benchmarks...");
+	if (!Allocations::counting) {
+		mainEngine->fmsg(Engine::MSG_INFO, "allocations are only counted in debug builds or with COUNT_ALLOCATIONS defined");
+	}
+	results.clear();
+	bool passed = checkInnovations();
+	passed = checkNetwork() && passed;
+	benchGame();
+	benchNetwork();
+	benchPool();
+	benchContainers();
+	benchRandom();
+	return write() && passed;
+}
+
+bool Bench::checkInnovations() {
+	Pool pool;
+	pool.inputSize = Game::boardW * Game::boardH;
+	pool.rand.seedValue(0);
+
+	Genome parent;
+	parent.pool = &pool;
+	parent.maxNeuron = pool.inputSize;
+	for (int c = 0; c < 20; ++c) {
+		parent.mutate(pool.rand);
+		pool.resolveInnovations(parent);
+	}
+
+	// the same split in two relatives, one of which has been numbering its nodes further along
+	// (a split picking a disabled gene does nothing, so keep trying seeds until one splits)
+	Genome a, b;
+	for (Uint32 seed = 0; a.genes.getSize() <= parent.genes.getSize(); ++seed) {
+		a = parent;
+		b = parent;
+		b.maxNeuron += 10;
+		Random randA, randB;
+		randA.seedValue(seed);
+		randB.seedValue(seed);
+		a.nodeMutate(randA);
+		b.nodeMutate(randB);
+	}
+	pool.resolveInnovations(a);
+	pool.resolveInnovations(b);
+
+	bool passed = a.genes.getSize() == b.genes.getSize();
+	for (size_t c = 0; passed && c < a.genes.getSize(); ++c) {
+		auto& geneA = a.genes[c];
+		auto& geneB = b.genes[c];
+		passed = geneA.into == geneB.into && geneA.out == geneB.out &&
+			geneA.innovation == geneB.innovation && geneA.enabled == geneB.enabled;
+	}
+	if (!passed) {
+		mainEngine->fmsg(Engine::MSG_ERROR, "check failed: genomes splitting the same link got different genes");
+	}
+	return passed;
+}
+
+template <typename Fn>
+void Bench::measure(const char* name, Fn&& fn, Uint64 opsPerCall) {
+	// one untimed call, so lazily sized buffers don't count against us
+	fn();
+
+	Uint64 iterations = 1;
+	while (1) {
+		Allocations::Scope allocations;
+		Uint64 copies = Genome::getNumCopies();
+		auto start = std::chrono::steady_clock::now();
+		for (Uint64 c = 0; c < iterations; ++c) {
+			fn();
+		}
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		if (seconds >= minSeconds) {
+			Result result;
+			result.name = name;
+			result.iterations = iterations * opsPerCall;
+			result.nsPerOp = seconds * 1e9 / (double)result.iterations;
+			result.allocsPerOp = (double)allocations.getCount() / (double)result.iterations;
+			result.copiesPerOp = (double)(Genome::getNumCopies() - copies) / (double)result.iterations;
+			results.push(result);
+			if (Allocations::counting) {
+				mainEngine->fmsg(Engine::MSG_INFO, "%s: %.1f ns/op, %.2f allocs/op, %.2f genome copies/op",
+					name, result.nsPerOp, result.allocsPerOp, result.copiesPerOp);
+			} else {
+				mainEngine->fmsg(Engine::MSG_INFO, "%s: %.1f ns/op, %.2f genome copies/op",
+					name, result.nsPerOp, result.copiesPerOp);
+			}
+			return;
+		}
+		iterations *= 2;
+	}
+}
+
+bool Bench::checkNetwork() {
+	Pool pool;
+	pool.inputSize = Game::boardW * Game::boardH;
+	pool.rand.seedValue(0);
+
+	// genomes of every age, from a few links to deep networks with loops
+	static const int numGenomes = 200;
+	ArrayList<float> inputs;
+	inputs.resize(pool.inputSize);
+	Genome genome;
+	genome.pool = &pool;
+	genome.maxNeuron = pool.inputSize;
+	int failures = 0;
+	float worst = 0.f;
+	for (int g = 0; g < numGenomes; ++g) {
+		genome.mutate(pool.rand);
+		pool.resolveInnovations(genome);
+		genome.generateNetwork();
+
+		// board cells some of the time, anything in [-1, 1] the rest
+		for (int c = 0; c < pool.inputSize; ++c) {
+			inputs[c] = g % 2 ? (float)(pool.rand.getUint8() % 3) - 1.f : pool.rand.getFloat() * 2.f - 1.f;
+		}
+
+		// both kernels start from the same remembered values
+		Network scalar = genome.network;
+		float expected[Genome::Output::OUT_MAX];
+		float outputs[Genome::Output::OUT_MAX];
+		float tolerances[Genome::Output::OUT_MAX];
+		scalar.evaluateScalar(inputs.getArray(), expected);
+		genome.network.evaluate(inputs.getArray(), outputs);
+		scalar.kernelTolerance(tolerances);
+		for (int o = 0; o < Genome::Output::OUT_MAX; ++o) {
+			float error = fabsf(expected[o] - outputs[o]);
+			if (error > tolerances[o]) {
+				++failures;
+				worst = std::max(worst, error - tolerances[o]);
+			}
+		}
+	}
+	if (failures) {
+		mainEngine->fmsg(Engine::MSG_ERROR, "check failed: %d network outputs strayed from the scalar kernel, by up to %g past tolerance",
+			failures, worst);
+	}
+	return failures == 0;
+}
+
+void Bench::benchGame() {
+	AI ai;
+	Genome genome;
+	Random rand;
+	rand.seedValue(0);
+
+	// a few hundred frames of random button mashing, replayed over and over
+	static const int numPatterns = 256;
+	float patterns[numPatterns][Genome::Output::OUT_MAX];
+	for (int c = 0; c < numPatterns; ++c) {
+		for (int o = 0; o < Genome::Output::OUT_MAX; ++o) {
+			patterns[c][o] = rand.getUint8() % 4 == 0 ? 1.f : 0.f;
+		}
+	}
+
+	Game game(&ai);
+	game.genome = &genome;
+	game.init(0);
+	int frame = 0;
+	measure("Game::process", [&]() {
+		auto& pattern = patterns[frame++ % numPatterns];
+		for (int o = 0; o < Genome::Output::OUT_MAX; ++o) {
+			genome.outputs[o] = pattern[o];
+		}
+		game.process();
+		if (!game.gameInSession) {
+			game.init(0);
+		}
+	});
+
+	// fork a game in play and put it back
+	GameState snapshot;
+	measure("Game::save+restore", [&]() {
+		game.save(snapshot);
+		game.restore(snapshot);
+		sink += snapshot.ticks;
+	});
+
+	// a ragged stack on the lower half of the board, probed at random positions
+	game.init(0);
+	for (int y = Game::boardH / 2; y < Game::boardH; ++y) {
+		for (int x = 0; x < Game::boardW; ++x) {
+			if (rand.getUint8() % 3 != 0) {
+				game.board[y * Game::boardW + x] = WHITE + 1;
+				game.rows[y] |= 1 << (x + Game::wallBits);
+			}
+		}
+	}
+	static const int numProbes = 256;
+	int probes[numProbes][3];
+	for (int c = 0; c < numProbes; ++c) {
+		probes[c][0] = (int)(rand.getUint8() % NUM_TETROMINOS);
+		probes[c][1] = (int)(rand.getUint8() % (Game::boardW + 1)) - 2;
+		probes[c][2] = (int)(rand.getUint8() % (Game::boardH + 1)) - 3;
+	}
+	int probe = 0;
+	measure("Game::blocked", [&]() {
+		auto& p = probes[probe++ % numProbes];
+		game.tetromino = p[0];
+		game.playerX = p[1];
+		game.playerY = p[2];
+		sink += game.blocked();
+	});
+
+	// every landing spot on the same stack, for each kind of piece in turn
+	Game::Placement placements[Game::maxPlacements];
+	int kind = 0;
+	measure("Game::findPlacements", [&]() {
+		game.tetromino = uniqueTetrominos[kind++ % NUM_UNIQUE_TETROMINOS];
+		game.playerX = Game::boardW / 2 - 2;
+		game.playerY = Game::spawnY;
+		sink += game.findPlacements(placements, Game::maxPlacements);
+	});
+
+	// four full rows at the bottom, rebuilt before every clear
+	measure("Game::clearLines", [&]() {
+		for (int y = Game::boardH - 4; y < Game::boardH; ++y) {
+			for (int x = 0; x < Game::boardW; ++x) {
+				game.board[y * Game::boardW + x] = WHITE + 1;
+			}
+			game.rows[y] = Game::fullRow;
+		}
+		sink += game.clearLines();
+	});
+}
+
+void Bench::benchNetwork() {
+	Pool pool;
+	pool.inputSize = Game::boardW * Game::boardH;
+	pool.rand.seedValue(0);
+
+	// a genome that has been around for a while
+	Genome genome;
+	genome.pool = &pool;
+	genome.maxNeuron = pool.inputSize;
+	for (int c = 0; c < 40; ++c) {
+		genome.mutate(pool.rand);
+		pool.resolveInnovations(genome);
+	}
+
+	measure("Genome::generateNetwork", [&]() {
+		genome.generateNetwork();
+	});
+
+	ArrayList<float> inputs;
+	inputs.resize(pool.inputSize);
+	for (int c = 0; c < pool.inputSize; ++c) {
+		inputs[c] = (float)(pool.rand.getUint8() % 3) - 1.f;
+	}
+	measure("Genome::evaluateNetwork", [&]() {
+		auto outputs = genome.evaluateNetwork(inputs);
+		sink += outputs.getSize();
+	});
+
+	float outputs[Genome::Output::OUT_MAX];
+	measure("Network::evaluate", [&]() {
+		genome.network.evaluate(inputs.getArray(), outputs);
+		sink += outputs[0] > 0.f;
+	});
+	measure("Network::evaluateScalar", [&]() {
+		genome.network.evaluateScalar(inputs.getArray(), outputs);
+		sink += outputs[0] > 0.f;
+	});
+
+	// two relatives with different histories
+	Genome other = genome;
+	for (int c = 0; c < 10; ++c) {
+		other.mutate(pool.rand);
+		pool.resolveInnovations(other);
+	}
+	Species species;
+	species.pool = &pool;
+	measure("Species::sameSpecies", [&]() {
+		sink += species.sameSpecies(&genome, &other);
+	});
+}
+
+void Bench::benchPool() {
+	Pool pool;
+	pool.inputSize = Game::boardW * Game::boardH;
+	pool.rand.seedValue(0);
+	pool.init();
+
+	// fitness normally comes from playing, here it is made up
+	Random rand;
+	rand.seedValue(0);
+	auto score = [&]() {
+		for (auto& spec : pool.species) {
+			for (auto& genome : spec.genomes) {
+				genome.fitness = 1 + rand.getUint16() % 1000;
+			}
+		}
+	};
+	measure("Pool::newGeneration", [&]() {
+		score();
+		pool.newGeneration();
+	});
+
+	// the same again, breeding and speciating on the AI's worker threads
+	AI ai;
+	pool.ai = &ai;
+	measure("Pool::newGeneration (threaded)", [&]() {
+		score();
+		pool.newGeneration();
+	});
+	pool.ai = nullptr;
+
+	// after a handful of generations the pool is a realistic size to save
+	for (int c = 0; c < 10; ++c) {
+		score();
+		pool.newGeneration();
+	}
+	measure("FileHelper::writeObject(Pool, Json)", [&]() {
+		sink += FileHelper::writeObject("bench.json", EFileFormat::Json, pool);
+	});
+	measure("FileHelper::writeObject(Pool, Binary)", [&]() {
+		sink += FileHelper::writeObject("bench.bin", EFileFormat::Binary, pool);
+	});
+	remove("bench.json");
+	remove("bench.bin");
+}
+
+void Bench::benchRandom() {
+	static const size_t numFloats = 256;
+	float values[numFloats];
+
+	// the same calls against both generators
+	Random::Algorithm algorithms[] = { Random::ALG_RC4, Random::ALG_XOSHIRO };
+	const char* names[][4] = {
+		{ "Random::getUint32 (RC4)", "Random::getBounded (RC4)", "Random::getFloat x256 (RC4)", "Random::fill x256 (RC4)" },
+		{ "Random::getUint32 (xoshiro)", "Random::getBounded (xoshiro)", "Random::getFloat x256 (xoshiro)", "Random::fill x256 (xoshiro)" },
+	};
+	for (int a = 0; a < 2; ++a) {
+		Random rand(algorithms[a]);
+		rand.seedValue(0);
+		measure(names[a][0], [&]() {
+			sink += rand.getUint32();
+		});
+		measure(names[a][1], [&]() {
+			sink += rand.getBounded(7);
+		});
+		measure(names[a][2], [&]() {
+			for (size_t c = 0; c < numFloats; ++c) {
+				values[c] = rand.getFloat();
+			}
+			sink += values[0] > 0.5f;
+		}, numFloats);
+		measure(names[a][3], [&]() {
+			rand.fill(values, numFloats);
+			sink += values[0] > 0.5f;
+		}, numFloats);
+	}
+}
+
+void Bench::benchContainers() {
+	Random rand;
+	rand.seedValue(0);
+
+	// genes arrive in mutation order, sorting groups them by the neuron they feed
+	static const int numGenes = 256;
+	ArrayList<Gene> genes;
+	for (int c = 0; c < numGenes; ++c) {
+		Gene gene;
+		gene.out = (int)(rand.getUint32() % AI::MaxNodes);
+		genes.push(gene);
+	}
+	ArrayList<Gene> sorted;
+	measure("ArrayList::sort", [&]() {
+		sorted = genes;
+		sorted.sort(Gene::AscSort());
+	});
+	measure("ArrayList::stableSort", [&]() {
+		sorted = genes;
+		sorted.stableSort(Gene::AscSort());
+	});
+
+	// keys spread like neuron ids: inputs, then outputs way up high, then hidden neurons
+	static const int numKeys = 1024;
+	Uint32 keys[numKeys];
+	for (int c = 0; c < numKeys; ++c) {
+		keys[c] = c < numKeys / 2 ? (Uint32)c : AI::MaxNodes + (Uint32)c;
+	}
+	Map<Uint32, int> map;
+	measure("Map::insert", [&]() {
+		Map<Uint32, int> fresh;
+		for (int c = 0; c < numKeys; ++c) {
+			fresh.insert(keys[c], c);
+		}
+		map = std::move(fresh);
+	}, numKeys);
+	measure("Map::insert (reserved)", [&]() {
+		Map<Uint32, int> fresh;
+		fresh.reserve(numKeys);
+		for (int c = 0; c < numKeys; ++c) {
+			fresh.insert(keys[c], c);
+		}
+		map = std::move(fresh);
+	}, numKeys);
+
+	int key = 0;
+	measure("Map::find", [&]() {
+		auto value = map.find(keys[key++ % numKeys]);
+		sink += value ? *value : 0;
+	});
+
+	LegacyMap<Uint32, int> legacy;
+	measure("LegacyMap::insert", [&]() {
+		LegacyMap<Uint32, int> fresh;
+		for (int c = 0; c < numKeys; ++c) {
+			fresh.insert(keys[c], c);
+		}
+		legacy = std::move(fresh);
+	}, numKeys);
+
+	measure("LegacyMap::find", [&]() {
+		auto value = legacy.find(keys[key++ % numKeys]);
+		sink += value ? *value : 0;
+	});
+}
+
+bool Bench::write() const {
+	FILE* fp = nullptr;
+	if (fopen_s(&fp, filename, "wb") || !fp) {
+		mainEngine->fmsg(Engine::MSG_ERROR, "failed to open '%s' for writing", filename);
+		return false;
+	}
+	fprintf(fp, "benchmark,iterations,ns_per_op,allocs_per_op,genome_copies_per_op\n");
+	for (auto& result : results) {
+		// allocations are left blank when they weren't counted, rather than claiming there were none
+		char allocs[32] = "";
+		if (Allocations::counting) {
+			snprintf(allocs, sizeof(allocs), "%.3f", result.allocsPerOp);
+		}
+		fprintf(fp, "\"%s\",%llu,%.2f,%s,%.3f\n", result.name, (unsigned long long)result.iterations,
+			result.nsPerOp, allocs, result.copiesPerOp);
+	}
+	fclose(fp);
+	mainEngine->fmsg(Engine::MSG_INFO, "wrote benchmark results to '%s'", filename);
+	return true;
+}
\ No newline at end of file
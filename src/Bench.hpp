@@ -0,0 +1,59 @@
+// Bench.hpp
+// Micro-benchmarks for the game and AI hot paths, run with -bench
+
+#pragma once
+
+#include "Main.hpp"
+#include "ArrayList.hpp"
+
+class Bench {
+public:
+	// @param filename the file to write results to, as CSV
+	Bench(const char* filename);
+	~Bench() {}
+
+	// run the correctness checks and every benchmark, and write the results
+	// @return true if every check passed and the results were written
+	bool run();
+
+private:
+	// one line of output
+	struct Result {
+		const char* name = nullptr;
+		Uint64 iterations = 0;
+		double nsPerOp = 0.0;
+		double allocsPerOp = 0.0;
+		double copiesPerOp = 0.0;	// deep copies of a Genome
+	};
+
+	static constexpr double minSeconds = 0.25;	// run each benchmark for at least this long
+
+	const char* filename = nullptr;
+	ArrayList<Result> results;
+
+	// time a function, doubling the iteration count until it has run long enough
+	// @param name the name of the benchmark
+	// @param fn the function to time
+	// @param opsPerCall how many operations each call of fn does
+	template <typename Fn>
+	void measure(const char* name, Fn&& fn, Uint64 opsPerCall = 1);
+
+	// two genomes that split the same link in one generation must get identical genes
+	// @return true if they do
+	bool checkInnovations();
+
+	// the vectorized network kernel must stay within Network::kernelTolerance() of the scalar one
+	// on random networks
+	// @return true if it does
+	bool checkNetwork();
+
+	void benchGame();
+	void benchNetwork();
+	void benchPool();
+	void benchContainers();
+	void benchRandom();
+
+	// write the results as CSV
+	// @return true on success
+	bool write() const;
+};
\ No newline at end of file
@@ -6,6 +6,7 @@
 #include "Directory.hpp"
 #include "Game.hpp"
 #include "AI.hpp"
+#include "Bench.hpp"
 
 #include <chrono>
 
@@ -37,6 +38,58 @@ Engine::Engine(int argc, char **argv):
 		frameval[c] = 0;
 	}
 
+	// parse command line
+	const char* badPieces = nullptr; // reported once the log is open
+	for( int c=1; c<argc; ++c ) {
+		if( argv[c] == nullptr ) {
+			continue;
+		}
+		if( strcmp(argv[c], "-train") == 0 ) {
+			headless = true;
+		} else if( strcmp(argv[c], "-batch") == 0 && c + 1 < argc ) {
+			trainBatchFrames = std::max(1, atoi(argv[c + 1]));
+			++c;
+		} else if( strcmp(argv[c], "-lockstep") == 0 ) {
+			trainLockstep = true;
+		} else if( strcmp(argv[c], "-budget") == 0 && c + 1 < argc ) {
+			trainFrameBudget = (Uint32)std::max(0, atoi(argv[c + 1]));
+			++c;
+		} else if( strcmp(argv[c], "-cutoff") == 0 && c + 1 < argc ) {
+			trainCutoffFitness = std::max(0LL, atoll(argv[c + 1]));
+			++c;
+		} else if( strcmp(argv[c], "-seed") == 0 && c + 1 < argc ) {
+			trainSeed = strtoull(argv[c + 1], nullptr, 10);
+			++c;
+		} else if( strcmp(argv[c], "-episodes") == 0 && c + 1 < argc ) {
+			trainEpisodes = std::max(1, atoi(argv[c + 1]));
+			++c;
+		} else if( strcmp(argv[c], "-race") == 0 ) {
+			trainRacing = true;
+		} else if( strcmp(argv[c], "-placement") == 0 ) {
+			trainPlacement = true;
+		} else if( strcmp(argv[c], "-skip") == 0 ) {
+			trainTimeSkip = true;
+		} else if( strcmp(argv[c], "-pieces") == 0 && c + 1 < argc ) {
+			if( strcmp(argv[c + 1], "game") == 0 ) {
+				trainPieces = AI::PIECES_PER_GAME;
+			} else if( strcmp(argv[c + 1], "bag") == 0 ) {
+				trainPieces = AI::PIECES_SHARED_BAG;
+			} else if( strcmp(argv[c + 1], "shared") == 0 ) {
+				trainPieces = AI::PIECES_SHARED;
+			} else {
+				badPieces = argv[c + 1];
+			}
+			++c;
+		} else if( strcmp(argv[c], "-bench") == 0 ) {
+			headless = true;
+			benchmark = true;
+			if( c + 1 < argc && argv[c + 1][0] != '-' ) {
+				benchFile = argv[c + 1];
+				++c;
+			}
+		}
+	}
+
 	// open log file
 	logLock = SDL_CreateMutex();
 	if( !logFile ) {
@@ -46,6 +99,9 @@ Engine::Engine(int argc, char **argv):
 		}
 	}
 	fmsg(Engine::MSG_INFO,"hello.");
+	if( badPieces ) {
+		fmsg(Engine::MSG_WARN,"unknown -pieces mode '%s', expected shared, bag or game", badPieces);
+	}
 }
 
 Engine::~Engine() {
@@ -56,6 +112,16 @@ void Engine::init() {
 	if( isInitialized() )
 		return;
 
+	// headless training needs no window, audio, or timer
+	if( headless ) {
+		if( benchmark ) {
+			initBenchmark();
+		} else {
+			initHeadless();
+		}
+		return;
+	}
+
 	// init sdl
 	fmsg(Engine::MSG_INFO,"initializing SDL...");
 	Uint32 initFlags = 0;
@@ -131,6 +197,65 @@ void Engine::init() {
 	initialized = true;
 }
 
+void Engine::initHeadless() {
+	// events only, so that ctrl+c still delivers SDL_QUIT
+	fmsg(Engine::MSG_INFO,"initializing SDL (headless)...");
+	if( SDL_Init( SDL_INIT_EVENTS ) == -1 ) {
+		fmsg(Engine::MSG_CRITICAL,"failed to initialize SDL: %s",SDL_GetError());
+		initialized = false;
+		return;
+	}
+
+	// start trainer
+	fmsg(Engine::MSG_INFO,"starting trainer");
+	ai = new AI();
+	ai->setBatchFrames(trainBatchFrames);
+	ai->setEvaluation(trainLockstep ? AI::EVAL_LOCKSTEP : AI::EVAL_COMPLETE);
+	ai->setFrameBudget(trainFrameBudget);
+	ai->setCutoffFitness(trainCutoffFitness);
+	ai->setSeed(trainSeed);
+	ai->setPieces(trainPieces);
+	ai->setEpisodes(trainEpisodes);
+	ai->setRacing(trainRacing);
+	ai->setControl(trainPlacement ? AI::CONTROL_PLACEMENT : AI::CONTROL_JOYPAD);
+	ai->setTimeSkip(trainTimeSkip);
+	ai->init();
+	trainStart = std::chrono::steady_clock::now();
+	lastReport = trainStart;
+
+	// done
+	fmsg(Engine::MSG_INFO,"done");
+	initialized = true;
+}
+
+void Engine::initBenchmark() {
+	// the benchmarks run to completion right here, then the main loop exits straight away
+	Bench bench(benchFile);
+	bench.run();
+	running = false;
+	initialized = true;
+}
+
+void Engine::reportTraining() {
+	auto now = std::chrono::steady_clock::now();
+	double elapsed = std::chrono::duration<double>(now - lastReport).count();
+	if( elapsed < reportInterval ) {
+		return;
+	}
+
+	Uint64 frames = ai->getFramesSimulated();
+	int generation = ai->getGeneration();
+	double gensPerSec = (double)(generation - lastReportGeneration) / elapsed;
+	double framesPerSec = (double)(frames - lastReportFrames) / elapsed;
+	double total = std::chrono::duration<double>(now - trainStart).count();
+	fmsg(Engine::MSG_INFO,"generation %d (%d%% measured): %.3f gens/sec, %.0f frames/sec, max fitness %lld, %.0f sec elapsed",
+		generation, ai->getMeasured(), gensPerSec, framesPerSec, (long long)ai->getMaxFitness(), total);
+
+	lastReport = now;
+	lastReportFrames = frames;
+	lastReportGeneration = generation;
+}
+
 void Engine::loadResources(const char* folder) {
 	fmsg(Engine::MSG_INFO,"loading resources from '%s'...", folder);
 }
@@ -157,8 +282,10 @@ void Engine::term() {
 		timer.join();
 
 	// free sounds
-	Mix_HaltMusic();
-	Mix_HaltChannel(-1);
+	if( !headless ) {
+		Mix_HaltMusic();
+		Mix_HaltChannel(-1);
+	}
 
 	// close game controllers
 	for( Node<SDL_GameController*>* node = controllers.getFirst(); node != nullptr; node = node->getNext() ) {
@@ -169,9 +296,11 @@ void Engine::term() {
 
 	// shutdown SDL subsystems
 	fmsg(MSG_INFO,"shutting down SDL and its subsystems...");
-	TTF_Quit();
-	IMG_Quit();
-	Mix_CloseAudio();
+	if( !headless ) {
+		TTF_Quit();
+		IMG_Quit();
+		Mix_CloseAudio();
+	}
 	SDL_Quit();
 
 	// dump engine resources
@@ -536,6 +665,18 @@ bool Engine::charsHaveLetters(const char *arr, size_t len) {
 void Engine::preProcess() {
 	anykeystatus = false;
 
+	// headless training runs a frame every cycle, as fast as possible
+	if( headless ) {
+		while( SDL_PollEvent(&event) ) {
+			if( event.type == SDL_QUIT ) {
+				shutdown();
+			}
+		}
+		++ticks;
+		framesToRun = 1;
+		return;
+	}
+
 	// lock mouse to window?
 	SDL_SetRelativeMouseMode((SDL_bool)mainEngine->isMouseRelative());
 
@@ -701,6 +842,11 @@ void Engine::process() {
 }
 
 void Engine::postProcess() {
+	if (headless) {
+		reportTraining();
+		++cycles;
+		return;
+	}
 	if (ranFrames) {
 		renderer->clearBuffers();
 		if (ai && ai->focus) {
@@ -13,14 +13,15 @@
 #include "Vector.hpp"
 #include "LinkedList.hpp"
 #include "Sound.hpp"
+#include "AI.hpp"
 
 #include <atomic>
 #include <thread>
+#include <chrono>
 
 class Game;
 class Renderer;
 class FileInterface;
-class AI;
 
 class Engine {
 public:
@@ -109,6 +110,7 @@ public:
 	const char*							getLastInput() const							{ return lastInput; }
 	LinkedList<SDL_GameController*>&	getControllers()								{ return controllers; }
 	const bool							isPlayTest() const								{ return playTest; }
+	const bool							isHeadless() const								{ return headless; }
 		
 	void								setPaused(const bool _paused)					{ paused = _paused; }
 	void								setInputStr(char* const _inputstr)				{ inputstr = _inputstr; inputnum = false; }
@@ -288,8 +290,20 @@ private:
 	// shuts down the engine
 	void term();
 
+	// initialize the engine for headless AI training (no window, GL context, or audio)
+	void initHeadless();
+
+	// run the benchmarks, write the results, and quit
+	void initBenchmark();
+
+	// log training throughput if enough time has passed since the last report
+	void reportTraining();
+
 	// general data
 	bool playTest = false;
+	bool headless = false; // if true, run the AI trainer without window, renderer, or audio
+	bool benchmark = false; // if true, run the benchmarks instead of the trainer (implies headless)
+	const char* benchFile = "bench.csv"; // where benchmark results are written
 	String combinedVersion;
 	bool initialized = false;
 	bool running = true;
@@ -370,4 +384,21 @@ private:
 	// game state
 	AI* ai = nullptr;
 	Game* gamestate = nullptr;
+
+	// training stats (headless)
+	int trainBatchFrames = 600; // frames each AI job runs a genome before synchronizing
+	bool trainLockstep = false; // if true, genomes are stepped in batches instead of each being run to the end
+	Uint32 trainFrameBudget = 0; // frames after which a genome's run is ended (0 = no limit)
+	int64_t trainCutoffFitness = 0; // fitness at which a genome's run is ended early (0 = no limit)
+	Uint64 trainSeed = 0; // seed of the training run (0 = pick one)
+	AI::Pieces trainPieces = AI::PIECES_SHARED; // where each game's pieces come from
+	int trainEpisodes = 1; // games each genome plays, its fitness is their mean
+	bool trainRacing = false; // if true, genomes are abandoned once they can't survive the cull
+	bool trainPlacement = false; // if true, genomes pick where each piece lands instead of pressing buttons
+	bool trainTimeSkip = false; // if true, frames in which nothing can happen are skipped over
+	static constexpr double reportInterval = 1.0; // seconds between throughput reports
+	std::chrono::steady_clock::time_point trainStart;
+	std::chrono::steady_clock::time_point lastReport;
+	Uint64 lastReportFrames = 0;
+	int lastReportGeneration = 0;
 };
\ No newline at end of file
@@ -5,6 +5,9 @@
 #include "Engine.hpp"
 #include "Renderer.hpp"
 #include "AI.hpp"
+#include "PieceSequence.hpp"
+
+static_assert(PieceSequence::numKinds == NUM_UNIQUE_TETROMINOS, "piece sequences deal every unique tetromino");
 
 Game::Game(AI* _ai) {
 	ai = _ai;
@@ -32,18 +35,37 @@ int Game::stopSound(int channel) {
 }
 
 void Game::init() {
-	board.clear();
+	rand.seedTime();
+	pieceSequence = nullptr;
+	reset();
+}
+
+void Game::init(Uint64 seed, const PieceSequence* pieces) {
+	rand.seedValue64(seed);
+	pieceSequence = pieces;
+	reset();
+}
+
+void Game::reset() {
 	board.resize(boardH * boardW);
 	int c = 0;
 	for (int y = 0; y < boardH; ++y) {
 		for (int x = 0; x < boardW; ++x, ++c) {
 			board[c] = 0;
 		}
+		rows[y] = emptyRow;
 	}
 
 	score = 0;
 	ticks = 0;
-	rand.seedTime();
+	piecesDealt = 0;
+
+	// nothing held yet, and the last repeat long enough ago that the first press moves right away
+	for (int c = 0; c < IN_MAX; ++c) {
+		inputs[c] = false;
+		oldInputs[c] = false;
+		inputTimes[c] = ticks - (Uint32)ticksPerSecond / 6;
+	}
 
 	state = PLAY;
 	stateTime = 0;
@@ -53,12 +75,19 @@ void Game::init() {
 
 void Game::term() {
 	gameInSession = false;
+	++changes;
 }
 
 void Game::newPiece() {
 	playerX = boardW / 2 - 2;
-	playerY = -3;
-	tetromino = uniqueTetrominos[rand.getUint8() % NUM_UNIQUE_TETROMINOS];
+	playerY = spawnY;
+	if (pieceSequence) {
+		tetromino = uniqueTetrominos[pieceSequence->get(piecesDealt)];
+	} else {
+		tetromino = uniqueTetrominos[rand.getBounded(NUM_UNIQUE_TETROMINOS)];
+	}
+	++piecesDealt;
+	++changes;
 	if (moved) {
 		moved = false;
 	} else {
@@ -101,6 +130,19 @@ void Game::draw(Camera& camera) {
 		}
 	}
 
+	// draw the falling piece, once it locks it is part of the board
+	if (state == State::PLAY) {
+		const TetrominoShape& shape = tetrominoShapes[tetromino];
+		for (int c = 0; c < 4; ++c) {
+			int x = playerX + shape.cellX[c];
+			int y = playerY + shape.cellY[c];
+			if (x >= 0 && y >= 0 && x < boardW && y < boardH) {
+				Rect<int> rect(offX + x * SQUARE_SIZE, offY + y * SQUARE_SIZE, SQUARE_SIZE, SQUARE_SIZE);
+				image->drawColor(nullptr, rect, colors[tetrominoColors[tetromino]]);
+			}
+		}
+	}
+
 	// score
 	{
 		Rect<int> rect;
@@ -206,13 +248,12 @@ void Game::process() {
 	}
 
 	if (state == State::PLAY) {
-		liftTetro();
-
 		if (repeat(IN_RIGHT)) {
 			++playerX;
 			if (blocked()) {
 				--playerX;
 			} else {
+				++changes;
 				playSound("sounds/move.wav", false);
 			}
 		}
@@ -222,6 +263,7 @@ void Game::process() {
 			if (blocked()) {
 				++playerX;
 			} else {
+				++changes;
 				playSound("sounds/move.wav", false);
 			}
 		}
@@ -231,6 +273,7 @@ void Game::process() {
 			if (blocked()) {
 				tetromino = rotateCCW[tetromino];
 			} else {
+				++changes;
 				playSound("sounds/rotate.wav", false);
 			}
 		}
@@ -240,30 +283,24 @@ void Game::process() {
 			if (blocked()) {
 				tetromino = rotateCW[tetromino];
 			} else {
+				++changes;
 				playSound("sounds/rotate.wav", false);
 			}
 		}
 
-		if (ticks) {
-			int beat = std::max(1, ticksPerSecond / (2 + (int)score / 5));
-			if ((inputs[IN_DOWN] && ticks % (beat / 8) == 0) ||
-				(!inputs[IN_DOWN] && ticks % beat == 0)) {
-				++playerY;
-				if (blocked()) {
-					--playerY;
-					bakeTetro();
-					state = State::CLEAR;
-					stateTime = ticks;
-					playSound("sounds/drop.wav", false);
-				}
-				else {
-					moved = true;
-				}
+		if (ticks && ticks % gravityTicks() == 0) {
+			++playerY;
+			++changes;
+			if (blocked()) {
+				--playerY;
+				bakeTetro();
+				state = State::CLEAR;
+				stateTime = ticks;
+				playSound("sounds/drop.wav", false);
+			}
+			else {
+				moved = true;
 			}
-		}
-
-		if (state == State::PLAY) {
-			bakeTetro();
 		}
 	}
 	if (state == State::CLEAR && ticks - stateTime >= (Uint32)ticksPerSecond / 3) {
@@ -293,81 +330,356 @@ void Game::process() {
 	++ticks;
 }
 
-void Game::bakeTetro() {
-	int startX = playerX;
-	int startY = playerY;
-	int endX = playerX + 4;
-	int endY = playerY + 4;
-	for (int y = startY; y < endY; ++y) {
-		for (int x = startX; x < endX; ++x) {
-			if (x < 0 || y < 0 || x >= boardW || y >= boardH) {
-				continue;
-			}
-			int u = x - startX;
-			int v = y - startY;
-			if (tetrominos[tetromino][v][u]) {
-				board[y * boardW + x] = tetrominoColors[tetromino];
+int Game::gravityTicks() const {
+	// soft drop falls eight times as fast, but never more than a row a frame
+	int beat = std::max(1, ticksPerSecond / (2 + (int)score / 5));
+	return inputs[IN_DOWN] ? std::max(1, beat / 8) : beat;
+}
+
+Uint32 Game::quietTicks() const {
+	if (!gameInSession) {
+		return 0;
+	}
+	Uint32 result = UINT32_MAX;
+	if (state == State::PLAY) {
+		// a press or release is handled on the frame it happens
+		if (inputs[IN_CW] != oldInputs[IN_CW] || inputs[IN_CCW] != oldInputs[IN_CCW]) {
+			return 0;
+		}
+
+		// a held direction repeats every ticksPerSecond / 6 frames, whether or not the piece can move
+		static const Input directions[2] = { IN_RIGHT, IN_LEFT };
+		for (auto in : directions) {
+			if (inputs[in]) {
+				Uint32 held = ticks - inputTimes[in];
+				Uint32 interval = (Uint32)ticksPerSecond / 6;
+				if (held >= interval) {
+					return 0;
+				}
+				result = std::min(result, interval - held);
 			}
 		}
+
+		// gravity never acts on the first frame
+		Uint32 gravity = (Uint32)gravityTicks();
+		Uint32 sinceFall = ticks % gravity;
+		result = std::min(result, ticks && !sinceFall ? 0 : gravity - sinceFall);
+	} else {
+		Uint32 elapsed = ticks - stateTime;
+		Uint32 wait = (Uint32)ticksPerSecond / 3;
+		result = std::min(result, elapsed >= wait ? 0 : wait - elapsed);
+	}
+	return result;
+}
+
+void Game::idle() {
+	assert(quietTicks() > 0);
+	++ticks;
+}
+
+void Game::save(GameState& snapshot) const {
+	for (int y = 0; y < boardH; ++y) {
+		snapshot.rows[y] = rows[y];
+	}
+	for (int c = 0; c < boardW * boardH; ++c) {
+		snapshot.board[c] = (Uint8)board[c];
+	}
+	rand.getState(snapshot.rand);
+	snapshot.pieceSequence = pieceSequence;
+	snapshot.piecesDealt = piecesDealt;
+	snapshot.score = score;
+	snapshot.ticks = ticks;
+	snapshot.changes = changes;
+	snapshot.stateTime = stateTime;
+	for (int c = 0; c < IN_MAX; ++c) {
+		snapshot.inputTimes[c] = inputTimes[c];
+		snapshot.inputs[c] = inputs[c];
+		snapshot.oldInputs[c] = oldInputs[c];
+	}
+	snapshot.tetromino = (Sint8)tetromino;
+	snapshot.playerX = (Sint8)playerX;
+	snapshot.playerY = (Sint8)playerY;
+	snapshot.state = (Uint8)state;
+	snapshot.moved = moved;
+	snapshot.gameInSession = gameInSession;
+}
+
+void Game::restore(const GameState& snapshot) {
+	board.resize(boardW * boardH);
+	for (int y = 0; y < boardH; ++y) {
+		rows[y] = snapshot.rows[y];
+	}
+	for (int c = 0; c < boardW * boardH; ++c) {
+		board[c] = snapshot.board[c];
+	}
+	rand.setState(snapshot.rand);
+	pieceSequence = snapshot.pieceSequence;
+	piecesDealt = snapshot.piecesDealt;
+	score = snapshot.score;
+	ticks = snapshot.ticks;
+	stateTime = snapshot.stateTime;
+	for (int c = 0; c < IN_MAX; ++c) {
+		inputTimes[c] = snapshot.inputTimes[c];
+		inputs[c] = snapshot.inputs[c];
+		oldInputs[c] = snapshot.oldInputs[c];
+	}
+	tetromino = snapshot.tetromino;
+	playerX = snapshot.playerX;
+	playerY = snapshot.playerY;
+	state = (State)snapshot.state;
+	moved = snapshot.moved;
+	gameInSession = snapshot.gameInSession;
+
+	// anyone watching changes must see this as a change, even when going back to an earlier one
+	changes = std::max(changes, snapshot.changes) + 1;
+}
+
+Uint16 Game::pieceRow(int v) const {
+	assert(playerX + wallBits >= 0);
+	return (Uint16)(tetrominoShapes[tetromino].rows[v] << (playerX + wallBits));
+}
+
+void Game::bakeTetro() {
+	const TetrominoShape& shape = tetrominoShapes[tetromino];
+	for (int v = shape.minY; v <= shape.maxY; ++v) {
+		int y = playerY + v;
+		if (y >= 0 && y < boardH) {
+			rows[y] |= pieceRow(v);
+		}
+	}
+	for (int c = 0; c < 4; ++c) {
+		int x = playerX + shape.cellX[c];
+		int y = playerY + shape.cellY[c];
+		if (x >= 0 && y >= 0 && x < boardW && y < boardH) {
+			board[y * boardW + x] = tetrominoColors[tetromino];
+		}
+	}
+}
+
+bool Game::blocked() {
+	return blocked(tetromino, playerX, playerY);
+}
+
+bool Game::blocked(int t, int x, int y) const {
+	const TetrominoShape& shape = tetrominoShapes[t];
+	if (y + shape.maxY >= boardH) {
+		return true;
+	}
+	for (int v = shape.minY; v <= shape.maxY; ++v) {
+		// above the board there is nothing to hit but the walls
+		int row = y + v;
+		Uint16 mask = row < 0 ? emptyRow : rows[row];
+		if (mask & (Uint16)(shape.rows[v] << (x + wallBits))) {
+			return true;
+		}
 	}
+	return false;
 }
 
-void Game::liftTetro() {
-	int startX = playerX;
-	int startY = playerY;
-	int endX = playerX + 4;
-	int endY = playerY + 4;
-	for (int y = startY; y < endY; ++y) {
-		for (int x = startX; x < endX; ++x) {
-			if (x < 0 || y < 0 || x >= boardW || y >= boardH) {
+int Game::findPlacements(Placement* placements, int capacity) {
+	// the current piece's orientations in clockwise order, the current one first
+	int orientations[4];
+	int numOrientations = 0;
+	int t = tetromino;
+	do {
+		orientations[numOrientations++] = t;
+		t = tetrominoShapes[t].cw;
+	} while (t != tetromino);
+	int cwOf[4], ccwOf[4];
+	for (int k = 0; k < numOrientations; ++k) {
+		cwOf[k] = (k + 1) % numOrientations;
+		ccwOf[k] = (k + numOrientations - 1) % numOrientations;
+	}
+
+	// states are sets of columns, one mask per orientation and row in the same layout as rows[].
+	// fits[k][i] has bit x + wallBits set if orientation k has room at column x and row i + spawnY
+	static const int numY = boardH - spawnY;
+	Uint16 fits[4][numY + 1];
+	for (int k = 0; k < numOrientations; ++k) {
+		const TetrominoShape& shape = tetrominoShapes[orientations[k]];
+		Uint16 columns = 0;
+		for (int x = -shape.minX; x + shape.maxX < boardW; ++x) {
+			columns |= (Uint16)(1 << (x + wallBits));
+		}
+		for (int i = 0; i < numY; ++i) {
+			int y = i + spawnY;
+			if (y + shape.maxY >= boardH) {
+				fits[k][i] = 0;
 				continue;
 			}
-			int u = x - startX;
-			int v = y - startY;
-			if (tetrominos[tetromino][v][u]) {
-				board[y * boardW + x] = 0;
+			Uint16 hits = 0;
+			for (int c = 0; c < 4; ++c) {
+				int row = y + shape.cellY[c];
+				if (row >= 0) {
+					hits |= rows[row] >> shape.cellX[c];
+				}
 			}
+			fits[k][i] = columns & ~hits;
 		}
+		fits[k][numY] = 0;
 	}
-}
 
-bool Game::blocked() {
-	int startX = playerX;
-	int startY = playerY;
-	int endX = playerX + 4;
-	int endY = playerY + 4;
-	for (int y = startY; y < endY; ++y) {
-		for (int x = startX; x < endX; ++x) {
-			int u = x - startX;
-			int v = y - startY;
-			if (tetrominos[tetromino][v][u]) {
-				if (x < 0 || x >= boardW || y >= boardH) {
-					return true;
+	// layers[d] holds the states exactly d inputs from the start, all of them between rows
+	// layerTop[d] and layerBottom[d]. nothing moves up, so each layer spans only a few rows
+	Uint16 layers[maxPathLength + 1][4][numY];
+	int layerTop[maxPathLength + 1];
+	int layerBottom[maxPathLength + 1];
+	Uint16 seen[4][numY];
+	for (int k = 0; k < numOrientations; ++k) {
+		for (int i = 0; i < numY; ++i) {
+			seen[k][i] = 0;
+		}
+	}
+	assert(playerY >= spawnY && playerY < boardH);
+	int start = playerY - spawnY;
+	Uint16 startColumn = (Uint16)(1 << (playerX + wallBits));
+	if (!(fits[0][start] & startColumn)) {
+		return 0;
+	}
+	layers[0][0][start] = seen[0][start] = startColumn;
+	for (int k = 1; k < numOrientations; ++k) {
+		layers[0][k][start] = 0;
+	}
+	layerTop[0] = layerBottom[0] = start;
+
+	// one input at a time, until there is nowhere new to go
+	int depth = 0;
+	while (depth < maxPathLength) {
+		const Uint16 (&from)[4][numY] = layers[depth];
+		Uint16 (&to)[4][numY] = layers[depth + 1];
+		int fromTop = layerTop[depth], fromBottom = layerBottom[depth];
+		int bottom = std::min(fromBottom + 1, numY - 1);
+		int newTop = numY, newBottom = -1;
+		for (int k = 0; k < numOrientations; ++k) {
+			for (int i = fromTop; i <= bottom; ++i) {
+				// fall from the row above, or shift or turn within the row
+				Uint16 reach = i > fromTop ? from[k][i - 1] : 0;
+				if (i <= fromBottom) {
+					Uint16 here = from[k][i];
+					reach |= (Uint16)((here << 1) | (here >> 1)) | from[ccwOf[k]][i] | from[cwOf[k]][i];
+				}
+				Uint16 added = reach & fits[k][i] & ~seen[k][i];
+				to[k][i] = added;
+				if (added) {
+					seen[k][i] |= added;
+					newTop = std::min(newTop, i);
+					newBottom = std::max(newBottom, i);
+				}
+			}
+		}
+		if (newBottom < 0) {
+			break;
+		}
+		++depth;
+		layerTop[depth] = newTop;
+		layerBottom[depth] = newBottom;
+	}
+
+	// a reached state locks if it can't fall any further. lowest rows first
+	int count = 0;
+	for (int i = numY - 1; i >= 0 && count < capacity; --i) {
+		for (int k = 0; k < numOrientations && count < capacity; ++k) {
+			Uint16 locks = seen[k][i] & ~fits[k][i + 1];
+			for (int column = 0; locks && count < capacity; ++column) {
+				Uint16 bit = (Uint16)(1 << column);
+				if (!(locks & bit)) {
+					continue;
 				}
-				if (y >= 0) {
-					if (board[y * boardW + x]) {
-						return true;
+				locks &= ~bit;
+
+				Placement& placement = placements[count++];
+				placement.tetromino = orientations[k];
+				placement.x = column - wallBits;
+				placement.y = i + spawnY;
+
+				// find the layer the state is in, then walk back through the layers,
+				// each step to a state one input closer to the start
+				int d = i - start;
+				while (i < layerTop[d] || i > layerBottom[d] || !(layers[d][k][i] & bit)) {
+					++d;
+				}
+				placement.pathLength = d;
+				int pk = k, pi = i, px = column;
+				for (; d > 0; --d) {
+					const Uint16 (&before)[4][numY] = layers[d - 1];
+					int beforeTop = layerTop[d - 1], beforeBottom = layerBottom[d - 1];
+					int cw = cwOf[pk];
+					int ccw = ccwOf[pk];
+					Input in;
+					if (pi - 1 >= beforeTop && pi - 1 <= beforeBottom && (before[pk][pi - 1] >> px) & 1) {
+						in = IN_DOWN;
+						--pi;
+					} else {
+						assert(pi >= beforeTop && pi <= beforeBottom);
+						if (px > 0 && (before[pk][pi] >> (px - 1)) & 1) {
+							in = IN_RIGHT;
+							--px;
+						} else if ((before[pk][pi] >> (px + 1)) & 1) {
+							in = IN_LEFT;
+							++px;
+						} else if ((before[ccw][pi] >> px) & 1) {
+							in = IN_CW;
+							pk = ccw;
+						} else {
+							assert((before[cw][pi] >> px) & 1);
+							in = IN_CCW;
+							pk = cw;
+						}
 					}
+					placement.path[d - 1] = (Uint8)in;
 				}
 			}
 		}
 	}
-	return false;
+
+	return count;
+}
+
+int Game::placedRows(const Placement& placement, Uint16* result) {
+	const TetrominoShape& shape = tetrominoShapes[placement.tetromino];
+	int cleared = 0;
+	for (int y = boardH - 1; y >= 0; --y) {
+		Uint16 row = rows[y];
+		int v = y - placement.y;
+		if (v >= 0 && v < 4) {
+			row |= (Uint16)(shape.rows[v] << (placement.x + wallBits));
+		}
+		if (row == fullRow) {
+			++cleared;
+		} else {
+			result[y + cleared] = row;
+		}
+	}
+	for (int y = 0; y < cleared; ++y) {
+		result[y] = emptyRow;
+	}
+
+	return cleared;
+}
+
+void Game::place(const Placement& placement) {
+	assert(state == State::PLAY);
+	if (placement.y > playerY) {
+		moved = true;
+	}
+	tetromino = placement.tetromino;
+	playerX = placement.x;
+	playerY = placement.y;
+	bakeTetro();
+	++changes;
+	state = State::CLEAR;
+	stateTime = ticks;
+	playSound("sounds/drop.wav", false);
 }
 
 int Game::clearLines() {
 	int result = 0;
 	for (int y = 0; y < boardH; ++y) {
-		bool filled = true;
-		for (int x = 0; x < boardW; ++x) {
-			if (board[y * boardW + x] == 0) {
-				filled = false;
-				break;
-			}
-		}
-		if (filled) {
+		if (rows[y] == fullRow) {
 			++result;
 			++score;
+			++changes;
+			rows[y] = emptyRow;
 			for (int u = 0; u < boardW; ++u) {
 				board[y * boardW + u] = 0;
 			}
@@ -377,20 +689,16 @@ int Game::clearLines() {
 }
 
 void Game::dropLines() {
+	++changes;
 	for (int y = 0; y < boardH; ++y) {
-		bool filled = false;
-		for (int x = 0; x < boardW; ++x) {
-			if (board[y * boardW + x] != 0) {
-				filled = true;
-				break;
-			}
-		}
-		if (!filled) {
+		if (rows[y] == emptyRow) {
 			for (int v = y; v > 0; --v) {
+				rows[v] = rows[v - 1];
 				for (int u = 0; u < boardW; ++u) {
 					board[v * boardW + u] = board[(v - 1) * boardW + u];
 				}
 			}
+			rows[0] = emptyRow;
 			for (int u = 0; u < boardW; ++u) {
 				board[u] = 0;
 			}
@@ -9,12 +9,16 @@
 #include "Random.hpp"
 #include "Pair.hpp"
 
+#include <type_traits>
+
 class Genome;
 class Game;
 class AI;
+class PieceSequence;
+struct GameState;
 
 static const int NUM_TETROMINOS = 19;
-static const char tetrominos[NUM_TETROMINOS][4][4] = {
+static constexpr char tetrominos[NUM_TETROMINOS][4][4] = {
 	{
 		{ 0, 0, 0, 0 },
 		{ 0, 0, 0, 0 },
@@ -142,7 +146,7 @@ static const int uniqueTetrominos[NUM_UNIQUE_TETROMINOS] = {
 	18
 };
 
-static const int rotateCW[NUM_TETROMINOS] = {
+static constexpr int rotateCW[NUM_TETROMINOS] = {
 	1, 0,
 	3, 2,
 	5, 4,
@@ -152,7 +156,7 @@ static const int rotateCW[NUM_TETROMINOS] = {
 	18
 };
 
-static const int rotateCCW[NUM_TETROMINOS] = {
+static constexpr int rotateCCW[NUM_TETROMINOS] = {
 	1, 0,
 	3, 2,
 	5, 4,
@@ -162,6 +166,70 @@ static const int rotateCCW[NUM_TETROMINOS] = {
 	18
 };
 
+// everything the game needs to know about one tetromino orientation.
+// built from the tables above at compile time, see makeShape()
+struct TetrominoShape {
+	int cellX[4] = { 0, 0, 0, 0 };		// column of each cell in the 4x4 grid
+	int cellY[4] = { 0, 0, 0, 0 };		// row of each cell in the 4x4 grid, cells are in reading order
+	int numCells = 0;					// always 4
+	int minX = 4, minY = 4;				// bounding box in the 4x4 grid, inclusive
+	int maxX = -1, maxY = -1;
+	int bottom[4] = { -1, -1, -1, -1 };	// lowest occupied row of each column, -1 if the column is empty
+	Uint16 rows[4] = { 0, 0, 0, 0 };	// one mask per row, bit u is column u
+	int cw = 0;							// orientation after rotating clockwise
+	int ccw = 0;						// orientation after rotating counter-clockwise
+};
+
+// derive the shape of an orientation from tetrominos, rotateCW and rotateCCW
+// @param t the orientation
+// @return the shape
+static constexpr TetrominoShape makeShape(int t) {
+	TetrominoShape shape;
+	for (int v = 0; v < 4; ++v) {
+		for (int u = 0; u < 4; ++u) {
+			if (!tetrominos[t][v][u]) {
+				continue;
+			}
+			if (shape.numCells < 4) {
+				shape.cellX[shape.numCells] = u;
+				shape.cellY[shape.numCells] = v;
+			}
+			++shape.numCells;
+			shape.minX = u < shape.minX ? u : shape.minX;
+			shape.minY = v < shape.minY ? v : shape.minY;
+			shape.maxX = u > shape.maxX ? u : shape.maxX;
+			shape.maxY = v > shape.maxY ? v : shape.maxY;
+			shape.bottom[u] = v;
+			shape.rows[v] |= (Uint16)(1 << u);
+		}
+	}
+	shape.cw = rotateCW[t];
+	shape.ccw = rotateCCW[t];
+	return shape;
+}
+
+static constexpr TetrominoShape tetrominoShapes[NUM_TETROMINOS] = {
+	makeShape(0), makeShape(1),
+	makeShape(2), makeShape(3),
+	makeShape(4), makeShape(5),
+	makeShape(6), makeShape(7), makeShape(8), makeShape(9),
+	makeShape(10), makeShape(11), makeShape(12), makeShape(13),
+	makeShape(14), makeShape(15), makeShape(16), makeShape(17),
+	makeShape(18)
+};
+
+// @return true if every orientation has 4 cells and the rotations undo each other
+static constexpr bool validShapes() {
+	for (int t = 0; t < NUM_TETROMINOS; ++t) {
+		const TetrominoShape& shape = tetrominoShapes[t];
+		if (shape.numCells != 4 || tetrominoShapes[shape.cw].ccw != t || tetrominoShapes[shape.ccw].cw != t) {
+			return false;
+		}
+	}
+	return true;
+}
+static_assert(validShapes(), "bad tetromino tables");
+
 // colors
 static const int WHITE = 0;
 static const int RED = 1;
@@ -199,9 +267,14 @@ public:
 	Game(AI* _ai);
 	~Game();
 
-	// init
+	// init, seeding the pieces from the current time
 	void init();
 
+	// init with a given seed, so the same seed always deals the same pieces
+	// @param seed the seed for the piece sequence
+	// @param pieces a sequence to deal the pieces from instead, shared with other games (may be nullptr)
+	void init(Uint64 seed, const PieceSequence* pieces = nullptr);
+
 	// term
 	void term();
 
@@ -220,6 +293,22 @@ public:
 	// process a frame
 	void process();
 
+	// @return how many frames from now process() would do nothing but count the frame, with the
+	// inputs held as they are. 0 if something can happen on the very next frame
+	Uint32 quietTicks() const;
+
+	// count a frame in which nothing happens, see quietTicks()
+	void idle();
+
+	// copy everything the simulation depends on into a snapshot. no allocation, so a game can be
+	// forked many times over for lookahead
+	// @param snapshot where to write the game's state
+	void save(GameState& snapshot) const;
+
+	// put the game back the way it was when the snapshot was saved
+	// @param snapshot a state from save()
+	void restore(const GameState& snapshot);
+
 	// draw a frame
 	void draw(Camera& camera);
 
@@ -241,11 +330,53 @@ public:
 	// game board
 	static const int boardW = 10;
 	static const int boardH = 20;
-	ArrayList<int> board;
+	static const int spawnY = -3;	// row of a new piece's 4x4 grid
+	ArrayList<int> board;		// color of each locked cell, 0 if empty. the falling piece is kept apart, in
+								// tetromino, playerX and playerY, and only added in when drawing or feeding the AI
+
+	// the locked board again as one mask per row, kept in step with board. column x is bit x + wallBits,
+	// and the wall bits on either side are always set so pieces collide with walls like blocks
+	static const int wallBits = 3;
+	static const Uint16 emptyRow = 0xE007;
+	static const Uint16 fullRow = 0xFFFF;
+	Uint16 rows[boardH];
+
+	// a spot the current piece can come to rest in, and the inputs that take it there
+	static const int maxPathLength = 64;
+	struct Placement {
+		int tetromino = 0;			// orientation
+		int x = 0;					// position of the orientation's 4x4 grid
+		int y = 0;
+		int pathLength = 0;			// inputs in path
+		Uint8 path[maxPathLength];	// one Input per step (IN_DOWN is one row of gravity or soft drop)
+	};
+	static const int maxPlacements = 160;	// more than a real stack ever offers, see findPlacements()
+
+	// list every spot the current piece can lock in, searching breadth first over the moves the
+	// player has: shifting, turning in place, and falling a row. each placement comes with one of the
+	// shortest input paths to it. spots lower on the board come first, so if there are more than
+	// capacity the highest are left out, as are spots more than maxPathLength inputs away
+	// @param placements where to write the placements
+	// @param capacity most placements to write
+	// @return the number of placements written
+	int findPlacements(Placement* placements, int capacity);
+
+	// the board as it would be with the current piece locked at a placement and full lines removed
+	// @param placement where the piece goes
+	// @param result where to write boardH row masks
+	// @return the number of lines the placement clears
+	int placedRows(const Placement& placement, Uint16* result);
+
+	// move the current piece straight to a placement and lock it there
+	// @param placement where the piece goes, see findPlacements()
+	void place(const Placement& placement);
 
 	Uint32 score = 0;
 	Uint32 ticks = 0;
-	Random rand;
+	Uint32 changes = 0;	// bumped whenever the board or the current piece changes, so observers can tell
+	Random rand { Random::ALG_XOSHIRO };
+	const PieceSequence* pieceSequence = nullptr;	// where pieces come from, rand if nullptr
+	Uint32 piecesDealt = 0;
 	int ticksPerSecond = 0;
 	bool gameInSession = false;
 
@@ -273,21 +404,58 @@ public:
 	int music = 0;
 	int musicChannel = -1;
 
-	// bake tetro into current position
+	// lock tetro into the board at its current position
 	void bakeTetro();
 
-	// lift tetro from current position
-	void liftTetro();
-
 	// return true if tetro is blocked in current position
 	bool blocked();
 
+	// @param t an orientation
+	// @param x column of the orientation's 4x4 grid
+	// @param y row of the orientation's 4x4 grid
+	// @return true if the orientation would overlap the walls, the floor, or a block there
+	bool blocked(int t, int x, int y) const;
+
+	// @param v row of the current tetromino
+	// @return that row of the tetromino shifted to playerX, in board mask coordinates
+	Uint16 pieceRow(int v) const;
+
+	// clear the board and deal the first piece
+	void reset();
+
 	// add a new piece to the board
 	void newPiece();
 
+	// @return frames between gravity steps of the current piece
+	int gravityTicks() const;
+
 	// check each row for a line clear
 	int clearLines();
 
 	// move rows down
 	void dropLines();
-};
\ No newline at end of file
+};
+
+// the simulation state of a Game, see Game::save(). plain data, so it can be copied around freely.
+// the AI, genome, sounds and tick rate belong to the game itself and aren't part of it
+struct GameState {
+	Uint16 rows[Game::boardH];
+	Uint8 board[Game::boardW * Game::boardH];	// cell colors
+	Uint64 rand[Random::stateWords];
+	const PieceSequence* pieceSequence;
+	Uint32 piecesDealt;
+	Uint32 score;
+	Uint32 ticks;
+	Uint32 changes;
+	Uint32 stateTime;
+	Uint32 inputTimes[Game::IN_MAX];
+	Sint8 tetromino;
+	Sint8 playerX;
+	Sint8 playerY;
+	Uint8 state;
+	bool moved;
+	bool gameInSession;
+	bool inputs[Game::IN_MAX];
+	bool oldInputs[Game::IN_MAX];
+};
+static_assert(std::is_trivially_copyable<GameState>::value, "GameState must stay plain data");
\ No newline at end of file
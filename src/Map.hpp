@@ -9,130 +9,193 @@
 
 #include <type_traits>
 
+// open-addressing hash map with robin hood probing.
+// all pairs live in one flat array. an entry never sits further from its home slot than the
+// entry it displaced would have, which keeps probe sequences short even at high load.
+// iteration order is unspecified and changes when the map grows.
 template <typename K, typename T>
 class Map {
 public:
-	static const size_t maxBucketSize = 1;
+	static const size_t minCapacity = 8;
+	static const size_t maxLoadPercent = 85;
 
 	Map() {
-		data.resize(numBuckets);
+	}
+	Map(const Map& src) {
+		copy(src);
+	}
+	Map(Map&& src) :
+		slots(src.slots),
+		hashes(src.hashes),
+		capacity(src.capacity),
+		size(src.size)
+	{
+		src.slots = nullptr;
+		src.hashes = nullptr;
+		src.capacity = 0;
+		src.size = 0;
 	}
 	~Map() {
+		reset();
+	}
+
+	Map& operator=(const Map& src) {
+		if (this != &src) {
+			copy(src);
+		}
+		return *this;
+	}
+
+	// take the contents of another map. the two maps trade contents
+	Map& operator=(Map&& src) {
+		std::swap(slots, src.slots);
+		std::swap(hashes, src.hashes);
+		std::swap(capacity, src.capacity);
+		std::swap(size, src.size);
+		return *this;
 	}
 
 	// getters & setters
-	ArrayList<OrderedPair<K, T>>&				getHash(size_t index)			{ return data[index]; }
-	const ArrayList<OrderedPair<K, T>>&			getHash(size_t index) const		{ return data[index]; }
-	size_t										getNumBuckets() const			{ return numBuckets; }
+	size_t										getCapacity() const				{ return capacity; }
 	size_t										getSize() const					{ return size; }
 
-	// clears the map of all key/value pairs
+	// clears the map of all key/value pairs, keeping its capacity
 	void clear() {
-		for (auto& bucket : data) {
-			bucket.clear();
+		for (size_t c = 0; c < capacity; ++c) {
+			if (hashes[c]) {
+				hashes[c] = 0;
+				slots[c] = OrderedPair<K, T>();
+			}
 		}
 		size = 0;
 	}
 
-	// not only clears the map, but also resets its size
+	// not only clears the map, but also frees its memory
 	void reset() {
-		data.clear();
+		if (slots) {
+			delete[] slots;
+			slots = nullptr;
+		}
+		if (hashes) {
+			delete[] hashes;
+			hashes = nullptr;
+		}
+		capacity = 0;
 		size = 0;
-		numBuckets = 4;
-		data.resize(numBuckets);
+	}
+
+	// make room for at least the given number of pairs without growing again
+	// @param count the number of pairs to make room for
+	void reserve(size_t count) {
+		size_t newCapacity = capacity ? capacity : minCapacity;
+		while (count * 100 > newCapacity * maxLoadPercent) {
+			newCapacity *= 2;
+		}
+		if (newCapacity > capacity) {
+			rehash(newCapacity);
+		}
 	}
 
 	// inserts a key/value pair into the Map
 	// @param key The key
 	// @param value The value associated with the key
 	void insert(const K& key, const T& value) {
-		T* oldValue = find(key);
-		if (oldValue) {
-			*oldValue = value;
-			return;
-		} else {
-			if (size + 1 >= numBuckets * maxBucketSize) {
-				rehash(numBuckets * 2);
-			}
+		put(key, value);
+	}
 
-			auto& list = data[hash(key) & (numBuckets - 1)];
-			list.push(OrderedPair<K, T>(key, value));
-			++size;
-		}
+	// inserts a key/value pair into the Map, moving the value in
+	// @param key The key
+	// @param value The value associated with the key
+	void insert(const K& key, T&& value) {
+		put(key, std::move(value));
 	}
 
 	// resize and rebuild the hash map
-	// @param newBucketCount Updated number of buckets in the map
-	void rehash(size_t newBucketCount) {
-		ArrayList<OrderedPair<K, T>> list;
-		for (auto& it : *this) {
-			list.push(it);
+	// @param newCapacity Updated number of slots in the map, must be a power of two
+	void rehash(size_t newCapacity) {
+		assert((newCapacity & (newCapacity - 1)) == 0);
+		assert(size * 100 <= newCapacity * maxLoadPercent);
+		OrderedPair<K, T>* oldSlots = slots;
+		Uint32* oldHashes = hashes;
+		size_t oldCapacity = capacity;
+
+		capacity = newCapacity;
+		size = 0;
+		slots = new OrderedPair<K, T>[capacity];
+		hashes = new Uint32[capacity];
+		for (size_t c = 0; c < capacity; ++c) {
+			hashes[c] = 0;
 		}
-		clear();
-		numBuckets = newBucketCount;
-		data.resize(numBuckets);
-		for (auto& it : list) {
-			insert(it.a, it.b);
+		for (size_t c = 0; c < oldCapacity; ++c) {
+			if (oldHashes[c]) {
+				place(oldHashes[c], std::move(oldSlots[c]), 0, oldHashes[c] & (capacity - 1));
+			}
+		}
+		if (oldSlots) {
+			delete[] oldSlots;
+		}
+		if (oldHashes) {
+			delete[] oldHashes;
 		}
 	}
 
 	// determine if the key with the given name exists
 	// @return true if key/value pair exists, false otherwise
 	bool exists(const K& key) const {
-		auto& list = data[hash(key) & (numBuckets - 1)];
-		for( auto& pair : list ) {
-			if( pair.a == key ) {
-				return true;
-			}
-		}
-		return false;
+		return locate(key) < capacity;
 	}
 
 	// removes a key/value pair from the Map
 	// @param key The key
 	// @return true if the key/value pair was removed, otherwise false
 	bool remove(const K& key) {
-		auto& list = data[hash(key) & (numBuckets - 1)];
-		for( size_t c = 0; c < list.getSize(); ++c ) {
-			auto& pair = list[c];
-			if( pair.a == key ) {
-				list.remove(c);
-				--size;
-				return true;
-			}
+		size_t index = locate(key);
+		if (index >= capacity) {
+			return false;
+		}
+
+		// pull the rest of the run back a slot, so nobody ends up behind a hole
+		size_t mask = capacity - 1;
+		size_t next = (index + 1) & mask;
+		while (hashes[next] && ((next - hashes[next]) & mask) != 0) {
+			hashes[index] = hashes[next];
+			slots[index] = std::move(slots[next]);
+			index = next;
+			next = (next + 1) & mask;
 		}
-		return false;
+		hashes[index] = 0;
+		slots[index] = OrderedPair<K, T>();
+		--size;
+		return true;
 	}
 
 	// find the key/value pair with the given name
 	// @param key The name of the pair to find
 	// @return the value associated with the key, or nullptr if it could not be found
 	T* find(const K& key) {
-		auto& list = data[hash(key) & (numBuckets - 1)];
-		for( auto& pair : list ) {
-			if( pair.a == key ) {
-				return &pair.b;
-			}
-		}
-		return nullptr;
+		size_t index = locate(key);
+		return index < capacity ? &slots[index].b : nullptr;
 	}
 	const T* find(const K& key) const {
-		auto& list = data[hash(key) & (numBuckets - 1)];
-		for( auto& pair : list ) {
-			if( pair.a == key ) {
-				return &pair.b;
-			}
-		}
-		return nullptr;
+		size_t index = locate(key);
+		return index < capacity ? &slots[index].b : nullptr;
 	}
 
 	// replace the contents of this map with those of another
 	// @param src The map to copy
 	void copy(const Map<K, T>& src) {
-		clear();
-		rehash(src.getNumBuckets());
-		for (auto& it : src) {
-			insert(it.a, it.b);
+		reset();
+		if (src.capacity) {
+			capacity = src.capacity;
+			size = src.size;
+			slots = new OrderedPair<K, T>[capacity];
+			hashes = new Uint32[capacity];
+			for (size_t c = 0; c < capacity; ++c) {
+				hashes[c] = src.hashes[c];
+				if (hashes[c]) {
+					slots[c] = src.slots[c];
+				}
+			}
 		}
 	}
 
@@ -143,6 +206,7 @@ public:
 			Uint32 keyCount = 0;
 			file->propertyName("data");
 			file->beginArray(keyCount);
+			reserve(size + keyCount);
 			for( Uint32 c = 0; c < keyCount; ++c ) {
 				K key;
 				T value;
@@ -152,14 +216,11 @@ public:
 				file->property("value", value);
 				file->endObject();
 
-				insert(key, value);
+				insert(key, std::move(value));
 			}
 			file->endArray();
 		} else {
-			Uint32 keyCount = 0;
-			for (Uint32 c = 0; c < numBuckets; ++c) {
-				keyCount += static_cast<Uint32>(data[c].getSize());
-			}
+			Uint32 keyCount = static_cast<Uint32>(size);
 
 			file->propertyName("data");
 			file->beginArray(keyCount);
@@ -186,106 +247,183 @@ public:
 	// Iterator
 	class Iterator {
 	public:
-		Iterator(Map<K, T>& _map, size_t _position, size_t _bucket) :
+		Iterator(Map<K, T>& _map, size_t _position) :
 			map(_map),
-			position(_position),
-			bucket(_bucket) {}
+			position(_position) {}
 
 		OrderedPair<K, T>& operator*() {
-			assert(bucket >= 0 && bucket < map.getNumBuckets());
-			assert(position >= 0 && position < map.getHash(bucket).getSize());
-			return map.getHash(bucket)[position];
+			assert(position < map.capacity && map.hashes[position]);
+			return map.slots[position];
 		}
 		Iterator& operator++() {
-			++position;
-			while( bucket < map.getNumBuckets() && position >= map.getHash(bucket).getSize() ) {
-				++bucket;
-				position = 0;
-			}
+			position = map.nextSlot(position + 1);
 			return *this;
 		}
 		bool operator!=(const Iterator& it) const {
-			return position != it.position || bucket != it.bucket;
+			return position != it.position;
 		}
 	private:
 		Map<K, T>& map;
 		size_t position;
-		size_t bucket;
 	};
 
 	// ConstIterator
 	class ConstIterator {
 	public:
-		ConstIterator(const Map<K, T>& _map, size_t _position, size_t _bucket) :
+		ConstIterator(const Map<K, T>& _map, size_t _position) :
 			map(_map),
-			position(_position),
-			bucket(_bucket) {}
+			position(_position) {}
 
 		const OrderedPair<K, T>& operator*() const {
-			assert(bucket >= 0 && bucket < map.getNumBuckets());
-			assert(position >= 0 && position < map.getHash(bucket).getSize());
-			return map.getHash(bucket)[position];
+			assert(position < map.capacity && map.hashes[position]);
+			return map.slots[position];
 		}
 		ConstIterator& operator++() {
-			++position;
-			while( bucket < map.getNumBuckets() && position >= map.getHash(bucket).getSize() ) {
-				++bucket;
-				position = 0;
-			}
+			position = map.nextSlot(position + 1);
 			return *this;
 		}
 		bool operator!=(const ConstIterator& it) const {
-			return position != it.position || bucket != it.bucket;
+			return position != it.position;
 		}
 	private:
 		const Map<K, T>& map;
 		size_t position;
-		size_t bucket;
 	};
 
 	// begin()
 	Iterator begin() {
-		size_t c = 0;
-		for (; c < numBuckets; ++c) {
-			if (data[c].getSize()) {
-				return Iterator(*this, 0, c);
-			}
-		}
-		return Iterator(*this, 0, c);
+		return Iterator(*this, nextSlot(0));
 	}
 	const ConstIterator begin() const {
-		size_t c = 0;
-		for (; c < numBuckets; ++c) {
-			if (data[c].getSize()) {
-				return ConstIterator(*this, 0, c);
-			}
-		}
-		return ConstIterator(*this, 0, c);
+		return ConstIterator(*this, nextSlot(0));
 	}
 
 	// end()
 	Iterator end() {
-		return Iterator(*this, 0, numBuckets);
+		return Iterator(*this, capacity);
 	}
 	const ConstIterator end() const {
-		return ConstIterator(*this, 0, numBuckets);
+		return ConstIterator(*this, capacity);
+	}
+
+	// scramble an integer so that nearby keys land in unrelated slots (murmur3 finalizer)
+	// @param key the integer to mix
+	// @return the mixed integer
+	static Uint32 mix(Uint32 key) {
+		key ^= key >> 16;
+		key *= 0x85ebca6b;
+		key ^= key >> 13;
+		key *= 0xc2b2ae35;
+		key ^= key >> 16;
+		return key;
 	}
 
 private:
-	ArrayList<ArrayList<OrderedPair<K, T>>> data;
-	size_t numBuckets = 4;
-	size_t size = 0;
+	OrderedPair<K, T>* slots = nullptr;	// key/value pairs
+	Uint32* hashes = nullptr;			// hash of the pair in each slot, 0 if the slot is empty
+	size_t capacity = 0;				// number of slots, always a power of two
+	size_t size = 0;					// number of pairs
+
+	// @return the hash of the key as stored in hashes[], never 0
+	Uint32 hashOf(const K& key) const {
+		Uint32 result = static_cast<Uint32>(hash(key));
+		return result ? result : 1;
+	}
+
+	// @param position the slot to start looking from
+	// @return the first occupied slot at or after position, or capacity if there isn't one
+	size_t nextSlot(size_t position) const {
+		while (position < capacity && !hashes[position]) {
+			++position;
+		}
+		return position;
+	}
+
+	// @return the slot holding the key, or capacity if it isn't in the map
+	size_t locate(const K& key) const {
+		if (!size) {
+			return capacity;
+		}
+		Uint32 h = hashOf(key);
+		size_t mask = capacity - 1;
+		size_t index = h & mask;
+		for (size_t distance = 0; ; ++distance) {
+			Uint32 slotHash = hashes[index];
+
+			// an empty slot, or an entry closer to home than we are, means the key isn't here
+			if (!slotHash || ((index - slotHash) & mask) < distance) {
+				return capacity;
+			}
+			if (slotHash == h && slots[index].a == key) {
+				return index;
+			}
+			index = (index + 1) & mask;
+		}
+	}
+
+	// insert or overwrite a pair
+	template <typename V>
+	void put(const K& key, V&& value) {
+		if ((size + 1) * 100 > capacity * maxLoadPercent) {
+			T* oldValue = find(key);
+			if (oldValue) {
+				*oldValue = std::forward<V>(value);
+				return;
+			}
+			rehash(capacity ? capacity * 2 : minCapacity);
+		}
+
+		Uint32 h = hashOf(key);
+		size_t mask = capacity - 1;
+		size_t index = h & mask;
+		size_t distance = 0;
+		while (hashes[index]) {
+			if (hashes[index] == h && slots[index].a == key) {
+				slots[index].b = std::forward<V>(value);
+				return;
+			}
+			if (((index - hashes[index]) & mask) < distance) {
+				break; // the key isn't in the map, and this is where it goes
+			}
+			index = (index + 1) & mask;
+			++distance;
+		}
+		place(h, OrderedPair<K, T>(key, std::forward<V>(value)), distance, index);
+	}
+
+	// put a pair that isn't in the map yet into a slot, shifting richer entries along
+	// @param h the pair's hash
+	// @param pair the pair
+	// @param distance how far the slot is from the pair's home slot
+	// @param index the slot
+	void place(Uint32 h, OrderedPair<K, T>&& pair, size_t distance, size_t index) {
+		OrderedPair<K, T> carry(std::move(pair));
+		size_t mask = capacity - 1;
+		while (hashes[index]) {
+			size_t slotDistance = (index - hashes[index]) & mask;
+			if (slotDistance < distance) {
+				std::swap(h, hashes[index]);
+				std::swap(carry, slots[index]);
+				distance = slotDistance;
+			}
+			index = (index + 1) & mask;
+			++distance;
+		}
+		hashes[index] = h;
+		slots[index] = std::move(carry);
+		++size;
+	}
 
-	template <typename K>
-	typename std::enable_if<std::is_class<K>::value, unsigned long>::type
-	hash(const K& key) const {
+	template <typename Key>
+	typename std::enable_if<std::is_class<Key>::value, unsigned long>::type
+	hash(const Key& key) const {
 		return key.hash();
 	}
 	unsigned long hash(Sint32 key) const {
-		return static_cast<unsigned long>(key);
+		return mix(static_cast<Uint32>(key));
 	}
 	unsigned long hash(Uint32 key) const {
-		return static_cast<unsigned long>(key);
+		return mix(key);
 	}
 	unsigned long hash(bool key) const {
 		return key ? 1 : 0;
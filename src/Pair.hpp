@@ -6,8 +6,8 @@ template <typename A, typename B>
 struct UnorderedPair {
 	UnorderedPair() {}
 	UnorderedPair(A _a, B _b) :
-		a(_a),
-		b(_b) {}
+		a(std::move(_a)),
+		b(std::move(_b)) {}
 	A a;
 	B b;
 
@@ -44,8 +44,8 @@ template <typename A, typename B>
 struct OrderedPair {
 	OrderedPair() {}
 	OrderedPair(A _a, B _b) :
-		a(_a),
-		b(_b) {}
+		a(std::move(_a)),
+		b(std::move(_b)) {}
 	A a;
 	B b;
 
@@ -0,0 +1,32 @@
+// PieceSequence.cpp
+
+#include "Main.hpp"
+#include "PieceSequence.hpp"
+#include "Random.hpp"
+
+void PieceSequence::generate(Uint64 seed, Order _order, size_t length) {
+	order = _order;
+	if (order == ORDER_BAG) {
+		// whole bags only, so starting over doesn't split one
+		length = std::max((size_t)1, (length + numKinds - 1) / numKinds) * numKinds;
+	}
+	pieces.resize(length);
+
+	Random rand(Random::ALG_XOSHIRO);
+	rand.seedValue64(seed);
+	if (order == ORDER_BAG) {
+		for (size_t c = 0; c < length; c += numKinds) {
+			Uint8* bag = &pieces[c];
+			for (int k = 0; k < numKinds; ++k) {
+				bag[k] = (Uint8)k;
+			}
+			for (int k = numKinds - 1; k > 0; --k) {
+				std::swap(bag[k], bag[rand.getBounded((Uint32)k + 1)]);
+			}
+		}
+	} else {
+		for (size_t c = 0; c < length; ++c) {
+			pieces[c] = (Uint8)rand.getBounded(numKinds);
+		}
+	}
+}
\ No newline at end of file
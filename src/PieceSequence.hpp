@@ -0,0 +1,45 @@
+// PieceSequence.hpp
+// A precomputed, read-only order of pieces that many games can deal from at once
+
+#pragma once
+
+#include "Main.hpp"
+#include "ArrayList.hpp"
+
+// games that deal from the same sequence all see the same pieces in the same order, so their
+// scores can be compared on equal terms. the sequence is never written while games are reading
+// it, so any number of threads can deal from it without locking.
+class PieceSequence {
+public:
+	static const int numKinds = 7;			// kinds of piece, see uniqueTetrominos
+	static const size_t defaultLength = numKinds * 1024;
+
+	// how pieces are drawn
+	enum Order {
+		ORDER_RANDOM,	// every piece is drawn on its own
+		ORDER_BAG,		// each run of seven is a shuffle of all seven kinds
+	};
+
+	PieceSequence() {}
+
+	// getters & setters
+	size_t getLength() const { return pieces.getSize(); }
+	Order getOrder() const { return order; }
+
+	// draw a new sequence
+	// @param seed the seed to draw it from, the same seed always draws the same sequence
+	// @param _order how to draw the pieces
+	// @param length the number of pieces before the sequence starts over
+	void generate(Uint64 seed, Order _order, size_t length = defaultLength);
+
+	// @param index how many pieces have been dealt before this one
+	// @return the kind of piece, from 0 to numKinds - 1
+	int get(Uint32 index) const {
+		assert(pieces.getSize());
+		return pieces[index % pieces.getSize()];
+	}
+
+private:
+	ArrayList<Uint8> pieces;
+	Order order = ORDER_RANDOM;
+};
\ No newline at end of file
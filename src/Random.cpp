@@ -4,7 +4,11 @@
 #include "Engine.hpp"
 #include "Random.hpp"
 
-Random::Random() {
+#include <atomic>
+
+Random::Random(Algorithm _algorithm) :
+	algorithm(_algorithm)
+{
 	seedTime();
 }
 
@@ -12,6 +16,16 @@ void Random::seedBytes(const Uint8* seed, size_t size) {
 	if( !seed || !size )
 		return;
 
+	if( algorithm == ALG_XOSHIRO ) {
+		// fold the seed into 64 bits (FNV-1a), then expand it into the whole state
+		Uint64 value = 0xcbf29ce484222325ULL;
+		for( size_t c = 0; c < size; ++c ) {
+			value = (value ^ seed[c]) * 0x100000001b3ULL;
+		}
+		seedValue64(value);
+		return;
+	}
+
 	Sint32 i, j;
 
 	for( i=0; i<256; ++i )
@@ -26,12 +40,9 @@ void Random::seedBytes(const Uint8* seed, size_t size) {
 }
 
 void Random::seedTime()  {
-	static time_t t;
-	if( t == 0 ) {
-		t = time(nullptr);
-	} else {
-		++t;
-	}
+	// games are seeded from many threads at once, so hand out each time value exactly once
+	static std::atomic<time_t> last(time(nullptr));
+	time_t t = last++;
 	seedBytes( (const Uint8*)&t, sizeof(time_t) );
 }
 
@@ -39,7 +50,47 @@ void Random::seedValue(Uint32 seed) {
 	seedBytes( (const Uint8*)&seed, sizeof(Uint32) );
 }
 
+void Random::seedValue64(Uint64 seed) {
+	if( algorithm == ALG_XOSHIRO ) {
+		for( int c = 0; c < 4; ++c ) {
+			x[c] = splitMix(seed);
+		}
+	} else {
+		seedBytes( (const Uint8*)&seed, sizeof(Uint64) );
+	}
+}
+
+Uint64 Random::deriveSeed(Uint64 seed, Uint64 index) {
+	Uint64 state = seed ^ (index * 0xd1b54a32d192ed03ULL);
+	splitMix(state);
+	return splitMix(state);
+}
+
+Uint64 Random::splitMix(Uint64& state) {
+	Uint64 z = (state += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+inline Uint64 Random::nextXoshiro() {
+	const Uint64 result = x[1] * 5;
+	const Uint64 rotated = ((result << 7) | (result >> 57)) * 9;
+	const Uint64 t = x[1] << 17;
+	x[2] ^= x[0];
+	x[3] ^= x[1];
+	x[1] ^= x[2];
+	x[0] ^= x[3];
+	x[2] ^= t;
+	x[3] = (x[3] << 45) | (x[3] >> 19);
+	return rotated;
+}
+
 Uint8 Random::getUint8() {
+	if( algorithm == ALG_XOSHIRO ) {
+		return (Uint8)(nextXoshiro() >> 56);
+	}
+
 	s_i = (s_i + 1) & 255;
 	s_j = (s_j + s[s_i]) & 255;
 	swapByte(s + s_i, s + s_j);
@@ -52,8 +103,12 @@ Sint8 Random::getSint8() {
 }
 
 Uint16 Random::getUint16() {
-	Uint16 value;
-	getBytes((Uint8*)&value,sizeof(Uint16));
+	if( algorithm == ALG_XOSHIRO ) {
+		return (Uint16)(nextXoshiro() >> 48);
+	}
+	// same bytes as getBytes() would write, lowest first
+	Uint16 value = getUint8();
+	value |= (Uint16)getUint8() << 8;
 	return value;
 }
 
@@ -64,8 +119,14 @@ Sint16 Random::getSint16() {
 }
 
 Uint32 Random::getUint32() {
-	Uint32 value;
-	getBytes((Uint8*)&value,sizeof(Uint32));
+	if( algorithm == ALG_XOSHIRO ) {
+		return (Uint32)(nextXoshiro() >> 32);
+	}
+	// same bytes as getBytes() would write, lowest first
+	Uint32 value = getUint8();
+	value |= (Uint32)getUint8() << 8;
+	value |= (Uint32)getUint8() << 16;
+	value |= (Uint32)getUint8() << 24;
 	return value;
 }
 
@@ -76,8 +137,11 @@ Sint32 Random::getSint32() {
 }
 
 Uint64 Random::getUint64() {
-	Uint64 value;
-	getBytes((Uint8*)&value,sizeof(Uint64));
+	if( algorithm == ALG_XOSHIRO ) {
+		return nextXoshiro();
+	}
+	Uint64 value = getUint32();
+	value |= (Uint64)getUint32() << 32;
 	return value;
 }
 
@@ -88,6 +152,17 @@ Sint64 Random::getSint64() {
 }
 
 void Random::getBytes(Uint8* buffer, size_t size) {
+	if( algorithm == ALG_XOSHIRO ) {
+		while( size>0 ) {
+			Uint64 value = nextXoshiro();
+			size_t len = std::min(size, sizeof(Uint64));
+			memcpy(buffer, &value, len);
+			buffer += len;
+			size -= len;
+		}
+		return;
+	}
+
 	while( size>0 ) {
 		*buffer = getUint8();
 		++buffer;
@@ -103,6 +178,54 @@ float Random::getFloat() {
 	return getUint32() / (float)(UINT32_MAX);
 }
 
+Uint32 Random::getBounded(Uint32 n) {
+	assert(n);
+	Uint64 product = (Uint64)getUint32() * n;
+	Uint32 low = (Uint32)product;
+	if( low < n ) {
+		// only draws that land in the uneven remainder are thrown away
+		Uint32 threshold = (0u - n) % n;
+		while( low < threshold ) {
+			product = (Uint64)getUint32() * n;
+			low = (Uint32)product;
+		}
+	}
+	return (Uint32)(product >> 32);
+}
+
+void Random::getState(Uint64* state) const {
+	assert(algorithm == ALG_XOSHIRO);
+	for( int c = 0; c < stateWords; ++c ) {
+		state[c] = x[c];
+	}
+}
+
+void Random::setState(const Uint64* state) {
+	assert(algorithm == ALG_XOSHIRO);
+	for( int c = 0; c < stateWords; ++c ) {
+		x[c] = state[c];
+	}
+}
+
+void Random::fill(float* values, size_t count) {
+	static const float scale = 1.f / 16777216.f; // 2^-24, floats hold 24 bits exactly
+	if( algorithm == ALG_XOSHIRO ) {
+		size_t c = 0;
+		for( ; c + 2 <= count; c += 2 ) {
+			Uint64 value = nextXoshiro();
+			values[c] = (float)(Uint32)(value >> 40) * scale;
+			values[c + 1] = (float)(Uint32)((value >> 8) & 0xFFFFFF) * scale;
+		}
+		if( c < count ) {
+			values[c] = (float)(Uint32)(nextXoshiro() >> 40) * scale;
+		}
+	} else {
+		for( size_t c = 0; c < count; ++c ) {
+			values[c] = (float)(getUint32() >> 8) * scale;
+		}
+	}
+}
+
 inline void Random::swapByte(Uint8* a, Uint8* b) {
 	Uint8 temp = *a;
 	*a = *b;
@@ -6,9 +6,19 @@
 
 class Random {
 public:
-	Random();
+	// generator algorithms
+	enum Algorithm {
+		ALG_RC4,		// byte-at-a-time stream cipher, the original generator
+		ALG_XOSHIRO,	// xoshiro256**, eight bytes per step from 32 bytes of state
+	};
+
+	// @param _algorithm the generator to use, seeded from the current time
+	Random(Algorithm _algorithm = ALG_RC4);
 	~Random() {}
 
+	// getters & setters
+	Algorithm getAlgorithm() const { return algorithm; }
+
 	// seed the rng based on the current time
 	void seedTime();
 
@@ -16,9 +26,19 @@ public:
 	// @param seed the seed to use
 	void seedValue(Uint32 seed);
 
+	// seed the rng based on the given 64-bit seed
+	// @param seed the seed to use
+	void seedValue64(Uint64 seed);
+
 	// seed the rng based on the given value
 	void seedBytes(const Uint8* seed, size_t size);
 
+	// derive the seed of a child stream, so a whole tree of streams follows from one seed
+	// @param seed the parent seed
+	// @param index which child
+	// @return the child's seed
+	static Uint64 deriveSeed(Uint64 seed, Uint64 index);
+
 	// @return an unsigned int (8-bit)
 	Uint8 getUint8();
 
@@ -49,16 +69,52 @@ public:
 	// @return a float (32-bit) (range 0-1, both inclusive)
 	float getFloat();
 
+	// an unbiased number below a bound (Lemire's multiply-shift, rarely needs a second draw).
+	// use this rather than getUint32() % n, which favors the low numbers
+	// @param n the bound, must not be 0
+	// @return a number from 0 to n - 1
+	Uint32 getBounded(Uint32 n);
+
+	// fill an array with floats, two per 64-bit step of ALG_XOSHIRO
+	// @param values the array to fill
+	// @param count the number of floats to write (range 0-1, 1 exclusive)
+	void fill(float* values, size_t count);
+
 	// generate a random value of the given size
 	// @param buffer the buffer to place the random value in
 	// @param size the size of the buffer in bytes
 	// @return a random number
 	void getBytes(Uint8* buffer, size_t size);
 
+	// number of words in the ALG_XOSHIRO state
+	static const int stateWords = 4;
+
+	// save the ALG_XOSHIRO state, so the generator can be picked up from here later
+	// @param state where to write stateWords words
+	void getState(Uint64* state) const;
+
+	// pick up where getState() left off
+	// @param state stateWords words from getState()
+	void setState(const Uint64* state);
+
 private:
+	Algorithm algorithm = ALG_RC4;
+
+	// ALG_RC4 state
 	unsigned char s[256];
 	Sint32 s_i, s_j;
 
+	// ALG_XOSHIRO state
+	Uint64 x[4];
+
+	// @return the next 64 bits from xoshiro256**
+	inline Uint64 nextXoshiro();
+
+	// advance a splitmix64 sequence, used to expand seeds
+	// @param state the sequence to advance
+	// @return the next value
+	static Uint64 splitMix(Uint64& state);
+
 	inline void swapByte(Uint8* a, Uint8* b);
 	inline Uint8 getByte(const Uint8* bytes, size_t num, size_t offset);
 };
\ No newline at end of file
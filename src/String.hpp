@@ -12,6 +12,13 @@ public:
 	String(const String& src) {
 		assign(src.get());
 	}
+	String(String&& src) :
+		str(src.str),
+		size(src.size)
+	{
+		src.str = nullptr;
+		src.size = 0;
+	}
 	String(const char* src) {
 		assign(src);
 	}
@@ -344,6 +351,18 @@ public:
 	const char* operator=(const String& src) {
 		return assign(src.get());
 	}
+	const char* operator=(String&& src) {
+		if( this != &src ) {
+			if( str ) {
+				free(str);
+			}
+			str = src.str;
+			size = src.size;
+			src.str = nullptr;
+			src.size = 0;
+		}
+		return get();
+	}
 
 	// conversion to const char*
 	operator const char*() const {
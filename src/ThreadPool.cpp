@@ -0,0 +1,112 @@
+// ThreadPool.cpp
+
+#include "Main.hpp"
+#include "ThreadPool.hpp"
+
+ThreadPool::ThreadPool(int numThreads) {
+	if (numThreads <= 0) {
+		numThreads = (int)std::thread::hardware_concurrency();
+	}
+	numWorkers = (size_t)std::max(1, numThreads);
+	workers = new Worker[numWorkers];
+	for (size_t c = 0; c < numWorkers; ++c) {
+		workers[c].thread = std::thread(&ThreadPool::work, this, c);
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lk(sleepLock);
+		running = false;
+	}
+	sleepSignal.notify_all();
+	for (size_t c = 0; c < numWorkers; ++c) {
+		if (workers[c].thread.joinable()) {
+			workers[c].thread.join();
+		}
+	}
+	delete[] workers;
+	workers = nullptr;
+}
+
+void ThreadPool::push(Job&& job) {
+	Worker& worker = workers[nextWorker];
+	nextWorker = (nextWorker + 1) % numWorkers;
+	++pending;
+	{
+		std::lock_guard<std::mutex> lk(worker.lock);
+		worker.jobs.push_back(std::move(job));
+	}
+	++queued;
+	{
+		std::lock_guard<std::mutex> lk(sleepLock);
+	}
+	sleepSignal.notify_one();
+}
+
+bool ThreadPool::take(size_t index, Job& job) {
+	// newest job from our own queue first, it is most likely to be warm in cache
+	{
+		Worker& worker = workers[index];
+		std::lock_guard<std::mutex> lk(worker.lock);
+		if (!worker.jobs.empty()) {
+			job = std::move(worker.jobs.back());
+			worker.jobs.pop_back();
+			--queued;
+			return true;
+		}
+	}
+
+	// otherwise steal the oldest job from somebody else
+	for (size_t c = 1; c < numWorkers; ++c) {
+		Worker& victim = workers[(index + c) % numWorkers];
+		std::lock_guard<std::mutex> lk(victim.lock);
+		if (!victim.jobs.empty()) {
+			job = std::move(victim.jobs.front());
+			victim.jobs.pop_front();
+			--queued;
+			return true;
+		}
+	}
+	return false;
+}
+
+void ThreadPool::run(Job& job) {
+	job();
+	job = nullptr;
+	if (--pending == 0) {
+		{
+			std::lock_guard<std::mutex> lk(sleepLock);
+		}
+		doneSignal.notify_all();
+	}
+}
+
+void ThreadPool::work(size_t index) {
+	Job job;
+	while (1) {
+		if (take(index, job)) {
+			run(job);
+			continue;
+		}
+		std::unique_lock<std::mutex> lk(sleepLock);
+		sleepSignal.wait(lk, [this]() { return !running || queued > 0; });
+		if (!running && queued == 0) {
+			return;
+		}
+	}
+}
+
+void ThreadPool::wait() {
+	Job job;
+	size_t index = 0;
+	while (pending > 0) {
+		if (take(index, job)) {
+			run(job);
+			continue;
+		}
+		index = (index + 1) % numWorkers;
+		std::unique_lock<std::mutex> lk(sleepLock);
+		doneSignal.wait(lk, [this]() { return pending == 0 || queued > 0; });
+	}
+}
\ No newline at end of file
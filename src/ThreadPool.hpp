@@ -0,0 +1,64 @@
+// ThreadPool.hpp
+// Long-lived worker threads with per-worker job queues and work stealing
+
+#pragma once
+
+#include "Main.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+class ThreadPool {
+public:
+	typedef std::function<void()> Job;
+
+	// @param numThreads number of worker threads to start, or 0 to match the hardware concurrency
+	ThreadPool(int numThreads = 0);
+	~ThreadPool();
+
+	// getters & setters
+	int getNumThreads() const { return (int)numWorkers; }
+
+	// queue a job, distributing jobs round-robin over the workers
+	// @param job the job to run
+	void push(Job&& job);
+
+	// block until every queued job has finished. the calling thread runs jobs while it waits
+	void wait();
+
+private:
+	struct Worker {
+		std::mutex lock;
+		std::deque<Job> jobs;
+		std::thread thread;
+	};
+
+	Worker* workers = nullptr;
+	size_t numWorkers = 0;
+	size_t nextWorker = 0;
+
+	std::mutex sleepLock;
+	std::condition_variable sleepSignal;	// wakes idle workers when jobs arrive
+	std::condition_variable doneSignal;		// wakes wait() when the last job finishes
+	std::atomic<int> queued { 0 };			// jobs sitting in a queue
+	std::atomic<int> pending { 0 };			// jobs queued or running
+	std::atomic<bool> running { true };
+
+	// worker thread loop
+	// @param index the worker's own queue
+	void work(size_t index);
+
+	// take a job from our own queue, or steal one from another worker
+	// @param index the queue to try first
+	// @param job the job that was taken
+	// @return true if a job was taken
+	bool take(size_t index, Job& job);
+
+	// run a job and signal wait() if it was the last one
+	// @param job the job to run
+	void run(Job& job);
+};
\ No newline at end of file